@@ -0,0 +1,101 @@
+/*
+	Event-driven GPS departures.
+
+	L_GPSSim computes the virtual finish time of every packet at its arrival, but the
+	real time at which the packet completes under fluid GPS depends on the packets
+	arriving afterwards. It is known as soon as the virtual time passes the virtual
+	finish time: from then on, the break points before it do not change any more, and
+	the real time follows from them by a descent of the augmented tree guided by the
+	virtual times (see L_GPSSim::VTime2RTime()).
+
+	L_GPSDepartureEngine interleaves the arrivals with the GPS departures: before an
+	arrival is handled, the packets finishing before it leave in order of virtual
+	finish time with their real finish times, which costs O(log n) per packet.
+*/
+#ifndef L_GPS_DEPARTURES_HPP
+#define L_GPS_DEPARTURES_HPP
+
+#include <vector>
+#include <queue>
+#include <limits>
+#include <stdexcept> // for runtime_error
+
+#include "L_GPSsim.hpp"
+
+//! class for the GPS simulator emitting the departures of the packets in real time order
+class L_GPSDepartureEngine{
+	//! GPS simulator
+	L_GPSSim *mpSimulator;
+	//! weight of each flow
+	std::vector<double> mFlowWeights;
+	//! virtual finish time of the last packet of each flow
+	std::vector<double> mFlowLastDepartVTimes;
+	//! packets in the system, the one with the smallest virtual finish time first
+	std::priority_queue<Packet *,std::vector<Packet *>,PKT_Compare_VFT_G> mPending;
+	//! real time of the last event
+	double mRTime;
+	//! function to emit the packets whose virtual finish time is no later than VTime
+	void Depart(double VTime,std::vector<Packet *>& departures)
+	{
+		while (!mPending.empty() && mPending.top()->mGPS_VFTime <= VTime)
+		{
+			Packet *pPKT = mPending.top();
+			mPending.pop();
+			pPKT->mGPS_RFTime = mpSimulator->VTime2RTime(pPKT->mGPS_VFTime);
+			departures.push_back(pPKT);
+		}
+	}
+public:
+	//! constructor
+	L_GPSDepartureEngine(const std::vector<double>& flowWeights)
+	{
+		mpSimulator = new L_GPSSim();
+		mFlowWeights = flowWeights;
+		mFlowLastDepartVTimes.resize(flowWeights.size());
+		mRTime = 0;
+	}
+	~L_GPSDepartureEngine()
+	{
+		delete mpSimulator;
+	}
+	//! function to move the real time forward to newRTime
+	/*! the packets finishing no later than newRTime are appended to departures, in order
+		of (virtual and real) finish time, with their real finish time in mGPS_RFTime
+	*/
+	void AdvanceTo(double newRTime,std::vector<Packet *>& departures)
+	{
+		if (newRTime < mRTime)
+			throw new std::runtime_error("Cannot move the real time backwards.");
+		mRTime = newRTime;
+		//! beyond the last break point the virtual time overshoots, but every packet is before it
+		Depart(mpSimulator->RTime2VTime(newRTime),departures);
+	}
+	//! function to handle the arrival of a packet (packets must arrive in order of arrival time)
+	/*! the packets finishing no later than its arrival are appended to departures first
+		(see AdvanceTo()), then its virtual finish time is set, and it is held until its
+		departure. Returns its virtual finish time.
+	*/
+	double HandleNewPacketArrival(Packet* pPKT,std::vector<Packet *>& departures)
+	{
+		AdvanceTo(pPKT->mArrivalTime,departures);
+		double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+		pPKT->mGPS_VFTime = mpSimulator->HandleNewPacketArrival(pPKT,mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+		mPending.push(pPKT);
+		return pPKT->mGPS_VFTime;
+	}
+	//! function to append the departures of all the packets in the system, when no packet arrives any more
+	void Finish(std::vector<Packet *>& departures)
+	{
+		size_t first = departures.size();
+		Depart(std::numeric_limits<double>::infinity(),departures);
+		if (departures.size() > first && departures.back()->mGPS_RFTime > mRTime)
+			mRTime = departures.back()->mGPS_RFTime;
+	}
+	//! get the number of packets in the system
+	size_t size()
+	{
+		return mPending.size();
+	}
+};
+
+#endif
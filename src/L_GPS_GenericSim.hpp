@@ -0,0 +1,110 @@
+/*
+	L-GPS simulator on any break point index (see L_GPS_Indexes.hpp).
+
+	The events are handled exactly as in L_GPSSim (the same virtual start and finish
+	times are computed, up to rounding), but the break points are kept in an index of
+	type Index, so that the balanced structures can be compared on real workloads.
+	Unlike L_GPSSim, the arrival break point of a backlogged flow is appended rather
+	than cancelled against the expected break point of its previous packet (the indexes
+	have no lookup by key), so the index keeps up to two break points per queued packet.
+*/
+#ifndef L_GPS_GENERIC_SIM_HPP
+#define L_GPS_GENERIC_SIM_HPP
+
+#include <cmath> // for fabs
+
+#include "L_GPS_Indexes.hpp"
+
+//! class for the L-GPS simulator on a break point index of type Index
+template <class Index>
+class L_GPSGenericSim{
+	//! virtual time, real time and total weight after the last event (see L_GPSSim)
+	double mOldVTime;
+	double mOldRTime;
+	double mSumWeight;
+	//! index of the break points after mOldRTime
+	Index mIndex;
+	//! function to restart the virtual clock if the server is idle at time newRTime (see L_GPSSim::RestartIfIdle())
+	void RestartIfIdle(double newRTime)
+	{
+		double eps = 1e-8;
+		if (mIndex.empty())
+		{
+			if (std::fabs(mSumWeight) <= eps)
+			{
+				mOldRTime = newRTime;
+				mSumWeight = 0;
+			}
+			return;
+		}
+		DataField total = mIndex.total();
+		if (std::fabs(mSumWeight + total.mDeltaWeight) > eps) return;
+		double lastRTime = mOldRTime + (total.mVTimeMax - mOldVTime) * mSumWeight - total.mDeltaRTime;
+		if (newRTime < lastRTime) return;
+
+		mOldVTime = total.mVTimeMax;
+		mOldRTime = newRTime;
+		mSumWeight = 0;
+		mIndex.clear();
+	}
+	//! function to insert a break point and to remove all the passed ones (see L_GPSSim::Append())
+	/*! since the arrival break points are not cancelled, several break points may be
+		passed at once (e.g., the expected break point of the previous packet of a flow
+		and its new arrival break point at the same virtual time), and all of them must
+		be removed, otherwise the sum of the weights misses some of them
+	*/
+	void Append(double curVTime,double newVTime,double newDeltaWeight)
+	{
+		mIndex.insert(DataField(newVTime,newDeltaWeight));
+		DataField breakPoint;
+		while (mIndex.removeMinIfNotAfter(curVTime,breakPoint))
+		{
+			mOldRTime += mSumWeight * (breakPoint.mVTimeMax - mOldVTime);
+			mOldVTime = breakPoint.mVTimeMax;
+			mSumWeight += breakPoint.mDeltaWeight;
+		}
+	}
+public:
+	//! constructor
+	L_GPSGenericSim()
+	{
+		mOldVTime = 0;
+		mOldRTime = 0;
+		mSumWeight = 0;
+	}
+	//! function to compute the corresponding virtual time for a new real time
+	/*! a (rounded) zero sum of weights only means that the server is idle if no break
+		point is pending; otherwise the descent passes the break points at NewRTime
+	*/
+	double RTime2VTime(double NewRTime)
+	{
+		double eps = 1e-8;
+		if (mIndex.empty())
+			return mOldVTime;
+		if (std::fabs(mSumWeight) <= eps && NewRTime <= mOldRTime)
+			return mOldVTime;
+		return mIndex.RTime2VTime(NewRTime,mOldVTime,mOldRTime,mSumWeight);
+	}
+	//! function to handle the event of packet arrival (see L_GPSSim::HandleNewPacketArrival())
+	double HandleNewPacketArrival(Packet* pPKT,double flowWeight,double& flowLastDepartVTime)
+	{
+		double newRTime = pPKT->mArrivalTime;
+		RestartIfIdle(newRTime);
+		double curVTime = RTime2VTime(newRTime);
+		double newVTime = curVTime;
+		if (newVTime < flowLastDepartVTime)
+			newVTime = flowLastDepartVTime;
+		double newExpectedBreakPoint = newVTime + pPKT->mLength / flowWeight;
+		flowLastDepartVTime = newExpectedBreakPoint;
+		Append(curVTime,newVTime,flowWeight);
+		Append(curVTime,newExpectedBreakPoint,-flowWeight);
+		return newExpectedBreakPoint;
+	}
+	//! get the index of the break points
+	Index& GetIndex()
+	{
+		return mIndex;
+	}
+};
+
+#endif
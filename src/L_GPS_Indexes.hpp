@@ -0,0 +1,550 @@
+/*
+	Alternative indexes of the break points of L-GPS.
+
+	L_GPSSim keeps its break points in a leaf-oriented AVL tree (see avlTree.hpp). This
+	file abstracts that tree behind a break point index, so that the simulation (see
+	L_GPS_GenericSim.hpp) can run on other balanced structures. An index provides:
+		void insert(const DataField& breakPoint)
+			inserts a break point, merging it with the break point of the same virtual time
+		bool removeMinIfNotAfter(double VTime,DataField& breakPoint)
+			removes the first break point if its virtual time is no greater than VTime,
+			in which case breakPoint receives it
+		bool empty()
+		size_t size()
+		DataField total()
+			aggregate of all the break points (maximum virtual time, sum of the weight
+			changes and real time offset, as computed by L_GPSAugmentation::combine())
+		double RTime2VTime(double RTime,double oldVTime,double oldRTime,double oldSumWeight)
+			virtual time at real time RTime, given the state before the first break point
+		void clear()
+	All the indexes maintain the same aggregates as the AVL tree, hence they return the
+	same virtual times up to rounding.
+
+	Indexes:
+	- AVLBreakPointIndex: the AVL tree of L_GPSSim (leaf-oriented);
+	- RBBreakPointIndex: left-leaning red-black tree (node-oriented);
+	- TreapBreakPointIndex: treap (node-oriented);
+	- SkipListBreakPointIndex: skip list whose links keep the aggregates of the break
+	  points they skip.
+	In the node-oriented trees, every node keeps one break point and the aggregate of
+	its subtree; the smallest node is cached, so that the check of removeMinIfNotAfter()
+	costs O(1).
+*/
+#ifndef L_GPS_INDEXES_HPP
+#define L_GPS_INDEXES_HPP
+
+#include <vector>
+#include <random>
+#include <cstddef>
+
+#include "L_GPSsim.hpp"
+
+//! function to concatenate the aggregates of two consecutive groups of break points
+inline DataField ConcatBreakPoints(const DataField& first,const DataField& second)
+{
+	DataField result;
+	L_GPSAugmentation::combine(result,first,second);
+	return result;
+}
+
+//! index of break points backed by the AVL tree of L_GPSSim
+/*! the index is not read concurrently, so its links are plain pointers
+*/
+class AVLBreakPointIndex{
+	AVL_Tree<DataField,Compare_VTM_L,L_GPSAugmentation> mTree;
+public:
+	//! the tree does not free its nodes by itself (see L_GPSSim::~L_GPSSim())
+	~AVLBreakPointIndex()
+	{
+		mTree.clear();
+	}
+	void insert(const DataField& breakPoint)
+	{
+		DataField data = breakPoint;
+		mTree.insert(data);
+	}
+	bool removeMinIfNotAfter(double VTime,DataField& breakPoint)
+	{
+		DataField data(VTime,0);
+		if (!mTree.removeLeftmostLeafIfNecessary(data)) return false;
+		breakPoint = data;
+		return true;
+	}
+	bool empty()
+	{
+		return mTree.empty();
+	}
+	size_t size()
+	{
+		return mTree.size();
+	}
+	DataField total()
+	{
+		return mTree.GetRoot()->data;
+	}
+	double RTime2VTime(double RTime,double oldVTime,double oldRTime,double oldSumWeight)
+	{
+		node<DataField> *pCurNode = mTree.GetRoot();
+		while (!mTree.IsLeaf(pCurNode))
+		{
+			const DataField& left = pCurNode->left->data;
+			double RTimeLMax = oldRTime + (left.mVTimeMax - oldVTime) * oldSumWeight - left.mDeltaRTime;
+			if (RTime < RTimeLMax)
+				pCurNode = pCurNode->left;
+			else
+			{
+				oldSumWeight += left.mDeltaWeight;
+				oldVTime = left.mVTimeMax;
+				oldRTime = RTimeLMax;
+				pCurNode = pCurNode->right;
+			}
+		}
+		return oldVTime + (RTime - oldRTime) / oldSumWeight;
+	}
+	void clear()
+	{
+		mTree.clear();
+	}
+};
+
+//! node of the node-oriented trees
+struct BreakPointNode{
+	//! break point kept by this node
+	DataField mBreakPoint;
+	//! aggregate of the break points of the subtree
+	DataField mSubtree;
+	BreakPointNode *left;
+	BreakPointNode *right;
+	//! color (red-black tree) or priority (treap)
+	unsigned mTag;
+	BreakPointNode(const DataField& breakPoint,unsigned tag)
+	{
+		mBreakPoint = breakPoint;
+		mSubtree = breakPoint;
+		left = right = NULL;
+		mTag = tag;
+	}
+	//! function to recompute the aggregate of the subtree from the children
+	void update()
+	{
+		mSubtree = left == NULL ? mBreakPoint : ConcatBreakPoints(left->mSubtree,mBreakPoint);
+		if (right != NULL)
+			mSubtree = ConcatBreakPoints(mSubtree,right->mSubtree);
+	}
+};
+
+//! base class of the node-oriented trees: queries, smallest node and deallocation
+class NodeBreakPointIndex{
+protected:
+	BreakPointNode *mpRoot;
+	//! node of the smallest break point (NULL if empty)
+	BreakPointNode *mpMin;
+	size_t mSize;
+	NodeBreakPointIndex()
+	{
+		mpRoot = mpMin = NULL;
+		mSize = 0;
+	}
+	~NodeBreakPointIndex()
+	{
+		clear();
+	}
+	static BreakPointNode* rotateLeft(BreakPointNode* h)
+	{
+		BreakPointNode *x = h->right;
+		h->right = x->left;
+		x->left = h;
+		h->update();
+		x->update();
+		return x;
+	}
+	static BreakPointNode* rotateRight(BreakPointNode* h)
+	{
+		BreakPointNode *x = h->left;
+		h->left = x->right;
+		x->right = h;
+		h->update();
+		x->update();
+		return x;
+	}
+	void resetMin()
+	{
+		mpMin = mpRoot;
+		if (mpMin == NULL) return;
+		while (mpMin->left != NULL)
+			mpMin = mpMin->left;
+	}
+	static void clear(BreakPointNode* current)
+	{
+		if (current == NULL) return;
+		clear(current->left);
+		clear(current->right);
+		delete current;
+	}
+public:
+	bool empty()
+	{
+		return mpRoot == NULL;
+	}
+	size_t size()
+	{
+		return mSize;
+	}
+	DataField total()
+	{
+		return mpRoot->mSubtree;
+	}
+	double RTime2VTime(double RTime,double oldVTime,double oldRTime,double oldSumWeight)
+	{
+		BreakPointNode *current = mpRoot;
+		while (current != NULL)
+		{
+			if (current->left != NULL)
+			{//! cross the left subtree if RTime is after its last break point
+				const DataField& left = current->left->mSubtree;
+				double RTimeLMax = oldRTime + (left.mVTimeMax - oldVTime) * oldSumWeight - left.mDeltaRTime;
+				if (RTime < RTimeLMax)
+				{
+					current = current->left;
+					continue;
+				}
+				oldSumWeight += left.mDeltaWeight;
+				oldVTime = left.mVTimeMax;
+				oldRTime = RTimeLMax;
+			}
+			//! then the break point of the node
+			const DataField& breakPoint = current->mBreakPoint;
+			double RTimeNode = oldRTime + (breakPoint.mVTimeMax - oldVTime) * oldSumWeight;
+			if (RTime < RTimeNode) break;
+			oldSumWeight += breakPoint.mDeltaWeight;
+			oldVTime = breakPoint.mVTimeMax;
+			oldRTime = RTimeNode;
+			current = current->right;
+		}
+		return oldVTime + (RTime - oldRTime) / oldSumWeight;
+	}
+	void clear()
+	{
+		clear(mpRoot);
+		mpRoot = mpMin = NULL;
+		mSize = 0;
+	}
+};
+
+//! index of break points backed by a left-leaning red-black tree (Sedgewick, 2008)
+class RBBreakPointIndex: public NodeBreakPointIndex{
+	static const unsigned BLACK = 0;
+	static const unsigned RED = 1;
+	static bool isRed(BreakPointNode* current)
+	{
+		return current != NULL && current->mTag == RED;
+	}
+	static BreakPointNode* rotateLeftColored(BreakPointNode* h)
+	{
+		BreakPointNode *x = rotateLeft(h);
+		x->mTag = h->mTag;
+		h->mTag = RED;
+		return x;
+	}
+	static BreakPointNode* rotateRightColored(BreakPointNode* h)
+	{
+		BreakPointNode *x = rotateRight(h);
+		x->mTag = h->mTag;
+		h->mTag = RED;
+		return x;
+	}
+	static void flipColors(BreakPointNode* h)
+	{
+		h->mTag ^= 1;
+		h->left->mTag ^= 1;
+		h->right->mTag ^= 1;
+	}
+	//! function to restore the left-leaning invariants at h on the way up
+	static BreakPointNode* balance(BreakPointNode* h)
+	{
+		if (isRed(h->right) && !isRed(h->left)) h = rotateLeftColored(h);
+		if (isRed(h->left) && isRed(h->left->left)) h = rotateRightColored(h);
+		if (isRed(h->left) && isRed(h->right)) flipColors(h);
+		h->update();
+		return h;
+	}
+	BreakPointNode* insert(BreakPointNode* h,const DataField& breakPoint)
+	{
+		if (h == NULL)
+		{
+			++ mSize;
+			BreakPointNode *x = new BreakPointNode(breakPoint,RED);
+			if (mpMin == NULL || breakPoint.mVTimeMax < mpMin->mBreakPoint.mVTimeMax)
+				mpMin = x;
+			return x;
+		}
+		if (breakPoint.mVTimeMax < h->mBreakPoint.mVTimeMax)
+			h->left = insert(h->left,breakPoint);
+		else if (h->mBreakPoint.mVTimeMax < breakPoint.mVTimeMax)
+			h->right = insert(h->right,breakPoint);
+		else
+			L_GPSAugmentation::merge(h->mBreakPoint,breakPoint);
+		return balance(h);
+	}
+	BreakPointNode* removeMin(BreakPointNode* h)
+	{
+		if (h->left == NULL)
+		{//! the smallest node of a left-leaning tree has no child
+			delete h;
+			return NULL;
+		}
+		if (!isRed(h->left) && !isRed(h->left->left))
+		{//! move a red link to the left
+			flipColors(h);
+			if (isRed(h->right->left))
+			{
+				h->right = rotateRightColored(h->right);
+				h = rotateLeftColored(h);
+				flipColors(h);
+			}
+		}
+		h->left = removeMin(h->left);
+		return balance(h);
+	}
+public:
+	void insert(const DataField& breakPoint)
+	{
+		mpRoot = insert(mpRoot,breakPoint);
+		mpRoot->mTag = BLACK;
+	}
+	bool removeMinIfNotAfter(double VTime,DataField& breakPoint)
+	{
+		if (mpMin == NULL || VTime < mpMin->mBreakPoint.mVTimeMax) return false;
+		breakPoint = mpMin->mBreakPoint;
+		if (!isRed(mpRoot->left) && !isRed(mpRoot->right))
+			mpRoot->mTag = RED;
+		mpRoot = removeMin(mpRoot);
+		if (mpRoot != NULL)
+			mpRoot->mTag = BLACK;
+		-- mSize;
+		resetMin();
+		return true;
+	}
+};
+
+//! index of break points backed by a treap
+class TreapBreakPointIndex: public NodeBreakPointIndex{
+	std::minstd_rand mRandom;
+	BreakPointNode* insert(BreakPointNode* t,const DataField& breakPoint)
+	{
+		if (t == NULL)
+		{
+			++ mSize;
+			BreakPointNode *x = new BreakPointNode(breakPoint,(unsigned)mRandom());
+			if (mpMin == NULL || breakPoint.mVTimeMax < mpMin->mBreakPoint.mVTimeMax)
+				mpMin = x;
+			return x;
+		}
+		if (breakPoint.mVTimeMax < t->mBreakPoint.mVTimeMax)
+		{
+			t->left = insert(t->left,breakPoint);
+			if (t->left->mTag > t->mTag)
+				return rotateRight(t);
+		}
+		else if (t->mBreakPoint.mVTimeMax < breakPoint.mVTimeMax)
+		{
+			t->right = insert(t->right,breakPoint);
+			if (t->right->mTag > t->mTag)
+				return rotateLeft(t);
+		}
+		else
+			L_GPSAugmentation::merge(t->mBreakPoint,breakPoint);
+		t->update();
+		return t;
+	}
+public:
+	TreapBreakPointIndex():mRandom(2007){}
+	void insert(const DataField& breakPoint)
+	{
+		mpRoot = insert(mpRoot,breakPoint);
+	}
+	bool removeMinIfNotAfter(double VTime,DataField& breakPoint)
+	{
+		if (mpMin == NULL || VTime < mpMin->mBreakPoint.mVTimeMax) return false;
+		breakPoint = mpMin->mBreakPoint;
+		//! the smallest node has no left child: replace it by its right child and fix the left spine
+		std::vector<BreakPointNode*> spine;
+		BreakPointNode **link = &mpRoot;
+		while ((*link)->left != NULL)
+		{
+			spine.push_back(*link);
+			link = &(*link)->left;
+		}
+		*link = mpMin->right;
+		delete mpMin;
+		for (size_t i = spine.size();i > 0;-- i)
+			spine[i - 1]->update();
+		-- mSize;
+		resetMin();
+		return true;
+	}
+};
+
+//! index of break points backed by a skip list
+/*! the link of level i from a node x to the next node y of level i keeps the aggregate
+	of the break points in (x, y], which are crossed at once by RTime2VTime()
+*/
+class SkipListBreakPointIndex{
+	static const int MAX_LEVEL = 32;
+	struct SkipNode{
+		DataField mBreakPoint;
+		std::vector<SkipNode*> mNext;
+		std::vector<DataField> mSpan;
+		SkipNode(const DataField& breakPoint,int level):mBreakPoint(breakPoint),mNext(level,(SkipNode*)NULL),mSpan(level){}
+	};
+	//! head of the list (without break point)
+	SkipNode mHead;
+	//! highest level in use
+	int mTop;
+	size_t mSize;
+	std::minstd_rand mRandom;
+	//! function to draw the level of a new node (geometric, p = 1/2)
+	int randomLevel()
+	{
+		int level = 1;
+		unsigned bits = mRandom();
+		while ((bits & 1) && level < MAX_LEVEL)
+		{
+			++ level;
+			bits >>= 1;
+		}
+		return level;
+	}
+	//! function to recompute the aggregate of the link of level i of x from the links below
+	static void updateSpan(SkipNode* x,int i)
+	{
+		SkipNode *end = x->mNext[i];
+		if (end == NULL) return;
+		if (i == 0)
+		{
+			x->mSpan[0] = end->mBreakPoint;
+			return;
+		}
+		DataField span = x->mSpan[i - 1];
+		for (SkipNode *y = x->mNext[i - 1];y != end;y = y->mNext[i - 1])
+			span = ConcatBreakPoints(span,y->mSpan[i - 1]);
+		x->mSpan[i] = span;
+	}
+public:
+	SkipListBreakPointIndex():mHead(DataField(),MAX_LEVEL),mRandom(2007)
+	{
+		mTop = 0;
+		mSize = 0;
+	}
+	~SkipListBreakPointIndex()
+	{
+		clear();
+	}
+	void insert(const DataField& breakPoint)
+	{
+		SkipNode *update[MAX_LEVEL];
+		SkipNode *x = &mHead;
+		for (int i = mTop;i >= 0;-- i)
+		{
+			while (x->mNext[i] != NULL && x->mNext[i]->mBreakPoint.mVTimeMax < breakPoint.mVTimeMax)
+				x = x->mNext[i];
+			update[i] = x;
+		}
+		SkipNode *next = x->mNext[0];
+		if (next != NULL && !(breakPoint.mVTimeMax < next->mBreakPoint.mVTimeMax))
+		{//! merge with the break point of the same virtual time
+			L_GPSAugmentation::merge(next->mBreakPoint,breakPoint);
+			for (int i = 0;i <= mTop;++ i)
+				updateSpan(update[i],i);
+			return;
+		}
+		int level = randomLevel();
+		for (;mTop < level - 1;++ mTop)
+			update[mTop + 1] = &mHead;
+		SkipNode *n = new SkipNode(breakPoint,level);
+		for (int i = 0;i < level;++ i)
+		{
+			n->mNext[i] = update[i]->mNext[i];
+			update[i]->mNext[i] = n;
+		}
+		//! bottom-up, as the links of level i are made of the links of level i - 1
+		for (int i = 0;i <= mTop;++ i)
+		{
+			if (i < level)
+				updateSpan(n,i);
+			updateSpan(update[i],i);
+		}
+		++ mSize;
+	}
+	bool removeMinIfNotAfter(double VTime,DataField& breakPoint)
+	{
+		SkipNode *first = mHead.mNext[0];
+		if (first == NULL || VTime < first->mBreakPoint.mVTimeMax) return false;
+		breakPoint = first->mBreakPoint;
+		int level = (int)first->mNext.size();
+		for (int i = 0;i <= mTop;++ i)
+			if (i < level)
+			{//! the links of the removed node skip exactly what the head must now skip
+				mHead.mNext[i] = first->mNext[i];
+				mHead.mSpan[i] = first->mSpan[i];
+			}
+			else
+				updateSpan(&mHead,i);
+		delete first;
+		while (mTop > 0 && mHead.mNext[mTop] == NULL)
+			-- mTop;
+		-- mSize;
+		return true;
+	}
+	bool empty()
+	{
+		return mHead.mNext[0] == NULL;
+	}
+	size_t size()
+	{
+		return mSize;
+	}
+	DataField total()
+	{
+		//! follow the links to the last break point from the highest level down, O(log n) on average
+		DataField result = mHead.mSpan[mTop];
+		SkipNode *x = mHead.mNext[mTop];
+		for (int i = mTop;i >= 0;-- i)
+			for (;x->mNext[i] != NULL;x = x->mNext[i])
+				result = ConcatBreakPoints(result,x->mSpan[i]);
+		return result;
+	}
+	double RTime2VTime(double RTime,double oldVTime,double oldRTime,double oldSumWeight)
+	{
+		//! as in the trees, the last break point is never crossed
+		SkipNode *x = &mHead;
+		for (int i = mTop;i >= 0;-- i)
+			while (x->mNext[i] != NULL && x->mNext[i]->mNext[0] != NULL)
+			{
+				const DataField& span = x->mSpan[i];
+				double RTimeMax = oldRTime + (span.mVTimeMax - oldVTime) * oldSumWeight - span.mDeltaRTime;
+				if (RTime < RTimeMax) break;
+				oldSumWeight += span.mDeltaWeight;
+				oldVTime = span.mVTimeMax;
+				oldRTime = RTimeMax;
+				x = x->mNext[i];
+			}
+		return oldVTime + (RTime - oldRTime) / oldSumWeight;
+	}
+	void clear()
+	{
+		SkipNode *x = mHead.mNext[0];
+		while (x != NULL)
+		{
+			SkipNode *next = x->mNext[0];
+			delete x;
+			x = next;
+		}
+		for (int i = 0;i < MAX_LEVEL;++ i)
+			mHead.mNext[i] = NULL;
+		mTop = 0;
+		mSize = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*
+	Multi-producer ingestion front-end for L_GPSSim.
+
+	HandleNewPacketArrival() must be called serially and in arrival order, while
+	packets are produced by many (e.g., NIC/RX) threads. Every producer owns a
+	lock-free SPSC ring, and a dedicated simulator thread merges the heads of all
+	the rings by arrival time and drains them in batches.
+
+	Each producer must push its packets in non-decreasing arrival time. The arrival
+	time of the last pushed packet is published as the producer's watermark, so the
+	simulator thread knows that a packet is safe to handle once every producer either
+	has a packet waiting, has a watermark no smaller than it, or is closed. An idle
+	producer can advance its watermark without pushing (advance()) to avoid holding
+	back the others.
+
+	The simulator thread never blocks: while no packet is safe to handle, it yields
+	and polls again. Therefore a producer which neither pushes, advances nor closes
+	holds back all the others, and keeps the simulator thread spinning (and join()
+	waiting) forever, so every producer must eventually be closed.
+*/
+#ifndef L_GPS_INGESTOR_HPP
+#define L_GPS_INGESTOR_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <stdexcept> // for runtime_error
+
+#include "L_GPSsim.hpp"
+#include "spscRing.hpp"
+
+//! class for the ingestion front-end feeding a single L_GPSSim from many producer threads
+class L_GPSIngestor{
+public:
+	//! class for one producer of the ingestor (used by a single thread)
+	class Producer{
+		friend class L_GPSIngestor;
+		//! ring shared with the simulator thread
+		SPSCRing<Packet *> mRing;
+		//! arrival time of the last pushed packet
+		std::atomic<long int> mWatermark;
+		//! set when the producer does not push any more packets
+		std::atomic<bool> mClosed;
+		Producer(size_t capacity):mRing(capacity)
+		{
+			mWatermark = std::numeric_limits<long int>::min();
+			mClosed = false;
+		}
+	public:
+		//! function to push a packet, returns false if the ring is full
+		bool tryPush(Packet *pPKT)
+		{
+			if (pPKT->mArrivalTime < mWatermark.load(std::memory_order_relaxed))
+				throw new std::runtime_error("Packets of a producer must be pushed in arrival order.");
+			if (!mRing.push(pPKT)) return false;
+			mWatermark.store(pPKT->mArrivalTime,std::memory_order_release);
+			return true;
+		}
+		//! function to push a packet, spins (without locking) while the ring is full
+		void push(Packet *pPKT)
+		{
+			while (!tryPush(pPKT))
+				std::this_thread::yield();
+		}
+		//! function to promise that no packet arriving before time will be pushed
+		void advance(long int time)
+		{
+			if (time > mWatermark.load(std::memory_order_relaxed))
+				mWatermark.store(time,std::memory_order_release);
+		}
+		//! function to close this producer
+		void close()
+		{
+			mClosed.store(true,std::memory_order_release);
+		}
+	};
+private:
+	//! the simulator
+	L_GPSSim *mpSimulator;
+	//! weight of each flow
+	std::vector<double> mFlowWeights;
+	//! virtual finish time of the last packet of each flow
+	std::vector<double> mFlowLastDepartVTimes;
+	//! producers
+	std::vector<Producer *> mProducers;
+	//! maximum number of packets merged before they are handled
+	size_t mBatchSize;
+	//! function called (on the simulator thread) for every handled packet
+	std::function<void(Packet *)> mOnPacket;
+	//! simulator thread
+	std::thread mThread;
+
+	//! function to pick the producer holding the earliest safe packet
+	/*! returns -1 if no packet is safe to handle yet, and -2 if all the producers
+		are closed and drained
+	*/
+	int NextProducer()
+	{
+		int best = -1;
+		long int bestTime = 0;
+		bool allDone = true;
+		for (size_t i = 0;i < mProducers.size();++ i)
+		{
+			Packet **ppPKT = mProducers[i]->mRing.front();
+			if (ppPKT != NULL)
+			{
+				allDone = false;
+				if (best < 0 || (*ppPKT)->mArrivalTime < bestTime)
+				{
+					best = i;
+					bestTime = (*ppPKT)->mArrivalTime;
+				}
+			}
+		}
+		for (size_t i = 0;i < mProducers.size();++ i)
+		{
+			Producer *p = mProducers[i];
+			//! closed must be checked before emptiness, so that no late push is missed
+			if (p->mClosed.load(std::memory_order_acquire) && p->mRing.empty()) continue;
+			allDone = false;
+			if (best < 0) continue;
+			//! a ring which was empty in the first scan may have received an earlier packet since
+			Packet **ppPKT = p->mRing.front();
+			if (ppPKT != NULL)
+			{
+				if ((*ppPKT)->mArrivalTime < bestTime) return -1;
+				continue;
+			}
+			//! an empty ring can only receive packets no earlier than its watermark
+			if (p->mWatermark.load(std::memory_order_acquire) < bestTime) return -1;
+		}
+		if (allDone) return -2;
+		return best;
+	}
+	//! main loop of the simulator thread
+	void SimulatorLoop()
+	{
+		std::vector<Packet *> batch;
+		batch.reserve(mBatchSize);
+		while (true)
+		{
+			//! merge the heads of the rings into a batch
+			int next = -1;
+			while (batch.size() < mBatchSize)
+			{
+				next = NextProducer();
+				if (next < 0) break;
+				Packet *pPKT = NULL;
+				mProducers[next]->mRing.pop(pPKT);
+				batch.push_back(pPKT);
+			}
+			if (batch.empty())
+			{
+				if (next == -2) return;
+				std::this_thread::yield();
+				continue;
+			}
+			//! handle the batch
+			for (auto pPKT: batch)
+			{
+				double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+				pPKT->mGPS_VFTime = mpSimulator->HandleNewPacketArrival(pPKT,mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+				if (mOnPacket) mOnPacket(pPKT);
+			}
+			batch.clear();
+		}
+	}
+public:
+	//! constructor
+	/*! onPacket is called on the simulator thread after the virtual finish time of a
+		packet is computed
+	*/
+	L_GPSIngestor(const std::vector<double>& flowWeights,std::function<void(Packet *)> onPacket = nullptr,size_t batchSize = 256)
+	{
+		mpSimulator = new L_GPSSim();
+		mFlowWeights = flowWeights;
+		mFlowLastDepartVTimes.resize(flowWeights.size());
+		mOnPacket = onPacket;
+		mBatchSize = batchSize > 0 ? batchSize : 1;
+	}
+	~L_GPSIngestor()
+	{
+		if (mThread.joinable())
+		{
+			for (auto p: mProducers)
+				p->close();
+			mThread.join();
+		}
+		for (auto p: mProducers)
+			delete p;
+		delete mpSimulator;
+	}
+	//! function to create a producer, must be called before start()
+	Producer* AddProducer(size_t capacity = 4096)
+	{
+		if (mThread.joinable())
+			throw new std::runtime_error("Cannot add producer to a running ingestor.");
+		Producer *p = new Producer(capacity);
+		mProducers.push_back(p);
+		return p;
+	}
+	//! function to launch the simulator thread
+	void start()
+	{
+		if (mThread.joinable())
+			throw new std::runtime_error("The ingestor is already running.");
+		mThread = std::thread(&L_GPSIngestor::SimulatorLoop,this);
+	}
+	//! function to wait until all the producers are closed and their packets are handled
+	/*! does not return while a producer is not closed (see above)
+	*/
+	void join()
+	{
+		if (mThread.joinable())
+			mThread.join();
+	}
+	L_GPSSim* GetSimulator()
+	{
+		return mpSimulator;
+	}
+};
+
+#endif
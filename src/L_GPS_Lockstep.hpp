@@ -0,0 +1,193 @@
+/*
+	SIMD lockstep descent of the augmented tree of L_GPSSim.
+
+	Independent RTime2VTime() queries are answered several at a time: each lane of
+	a vector register holds the state (virtual time, real time and total weight) of
+	one query, and all the lanes descend the tree together. At every level the
+	children's augmented members are loaded for all the lanes, RTimeLMax is computed
+	and compared with the query times in vector registers, and the state is updated
+	by blending, so the latency of the node loads of different queries overlaps.
+	Lanes which reached a leaf are masked out until all the lanes of the group did.
+
+	Kernels:
+	- AVX2: two groups of 4 lanes, i.e., 8 queries in flight;
+	- SSE2: 2 lanes;
+	- scalar: one query at a time.
+	The widest kernel supported by the CPU is selected at runtime. No fused
+	multiply-add is used, hence every kernel gives results bit-identical to RTime2VTime().
+*/
+#ifndef L_GPS_LOCKSTEP_HPP
+#define L_GPS_LOCKSTEP_HPP
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LGPS_LOCKSTEP_X86
+#include <immintrin.h>
+#endif
+
+//! instruction sets of the lockstep descent kernels, from the narrowest to the widest
+enum LockstepISA {LOCKSTEP_SCALAR = 0,LOCKSTEP_SSE2 = 1,LOCKSTEP_AVX2 = 2};
+
+//! class for the lockstep descent kernels on trees of nodes of type Node
+/*! Node must provide left and right children (NULL for leaves) and data with the
+	augmented members mVTimeMax, mDeltaWeight and mDeltaRTime
+*/
+template <class Node>
+class LockstepDescent{
+	//! function to load the augmented members of the left children of the active lanes
+	static inline void loadLeft(Node* const* nodes,int active,int laneNum,double* VTimeMax,double* deltaRTime,double* deltaWeight)
+	{
+		for (int l = 0;l < laneNum;++ l)
+			if (active >> l & 1)
+			{
+				const Node* left = nodes[l]->left;
+				VTimeMax[l] = left->data.mVTimeMax;
+				deltaRTime[l] = left->data.mDeltaRTime;
+				deltaWeight[l] = left->data.mDeltaWeight;
+			}
+			else
+				VTimeMax[l] = deltaRTime[l] = deltaWeight[l] = 0.0;
+	}
+	//! function to get the bit mask of the lanes which are not at a leaf yet
+	static inline int activeLanes(Node* const* nodes,int laneNum)
+	{
+		int active = 0;
+		for (int l = 0;l < laneNum;++ l)
+			active |= (nodes[l]->left != NULL) << l;
+		return active;
+	}
+	//! function to move the active lanes to their left or right child
+	static inline void moveDown(Node** nodes,int active,int isRight,int laneNum)
+	{
+		for (int l = 0;l < laneNum;++ l)
+			if (active >> l & 1)
+				nodes[l] = (isRight >> l & 1) ? nodes[l]->right : nodes[l]->left;
+	}
+public:
+	//! scalar kernel
+	static void descendScalar(Node* root,double VTime,double RTime,double sumWeight,const double* times,size_t n,double* out)
+	{
+		for (size_t i = 0;i < n;++ i)
+		{
+			double oldVTime = VTime, oldRTime = RTime, oldSumWeight = sumWeight;
+			Node* current = root;
+			while (current->left != NULL)
+			{
+				const Node* left = current->left;
+				double RTimeLMax = oldRTime + (left->data.mVTimeMax - oldVTime) * oldSumWeight - left->data.mDeltaRTime;
+				if (times[i] < RTimeLMax)
+					current = current->left;
+				else
+				{
+					oldSumWeight += left->data.mDeltaWeight;
+					oldVTime = left->data.mVTimeMax;
+					oldRTime = RTimeLMax;
+					current = current->right;
+				}
+			}
+			out[i] = oldVTime + (times[i] - oldRTime) / oldSumWeight;
+		}
+	}
+#ifdef LGPS_LOCKSTEP_X86
+	//! SSE2 kernel, 2 lanes
+	__attribute__((target("sse2")))
+	static void descendSSE2(Node* root,double VTime,double RTime,double sumWeight,const double* times,size_t n,double* out)
+	{
+		const int LANES = 2;
+		size_t i = 0;
+		for (;i + LANES <= n;i += LANES)
+		{
+			Node* nodes[LANES] = {root,root};
+			__m128d T = _mm_loadu_pd(times + i);
+			__m128d V = _mm_set1_pd(VTime), R = _mm_set1_pd(RTime), W = _mm_set1_pd(sumWeight);
+			int active;
+			while ((active = activeLanes(nodes,LANES)) != 0)
+			{
+				double lv[LANES], ldr[LANES], ldw[LANES];
+				loadLeft(nodes,active,LANES,lv,ldr,ldw);
+				__m128d LV = _mm_loadu_pd(lv), LDR = _mm_loadu_pd(ldr), LDW = _mm_loadu_pd(ldw);
+				__m128d RL = _mm_sub_pd(_mm_add_pd(R,_mm_mul_pd(_mm_sub_pd(LV,V),W)),LDR);
+				__m128d activeMask = _mm_castsi128_pd(_mm_set_epi64x(-(long long)(active >> 1 & 1),-(long long)(active & 1)));
+				__m128d right = _mm_and_pd(_mm_cmpnlt_pd(T,RL),activeMask);
+				W = _mm_or_pd(_mm_and_pd(right,_mm_add_pd(W,LDW)),_mm_andnot_pd(right,W));
+				V = _mm_or_pd(_mm_and_pd(right,LV),_mm_andnot_pd(right,V));
+				R = _mm_or_pd(_mm_and_pd(right,RL),_mm_andnot_pd(right,R));
+				moveDown(nodes,active,_mm_movemask_pd(right),LANES);
+			}
+			_mm_storeu_pd(out + i,_mm_add_pd(V,_mm_div_pd(_mm_sub_pd(T,R),W)));
+		}
+		descendScalar(root,VTime,RTime,sumWeight,times + i,n - i,out + i);
+	}
+	//! AVX2 kernel, two groups of 4 lanes
+	__attribute__((target("avx2")))
+	static void descendAVX2(Node* root,double VTime,double RTime,double sumWeight,const double* times,size_t n,double* out)
+	{
+		const int LANES = 8;
+		size_t i = 0;
+		for (;i + LANES <= n;i += LANES)
+		{
+			Node* nodes[LANES] = {root,root,root,root,root,root,root,root};
+			__m256d T[2], V[2], R[2], W[2];
+			for (int g = 0;g < 2;++ g)
+			{
+				T[g] = _mm256_loadu_pd(times + i + 4 * g);
+				V[g] = _mm256_set1_pd(VTime);
+				R[g] = _mm256_set1_pd(RTime);
+				W[g] = _mm256_set1_pd(sumWeight);
+			}
+			int active;
+			while ((active = activeLanes(nodes,LANES)) != 0)
+			{
+				double lv[LANES], ldr[LANES], ldw[LANES];
+				loadLeft(nodes,active,LANES,lv,ldr,ldw);
+				int isRight = 0;
+				for (int g = 0;g < 2;++ g)
+				{
+					__m256d LV = _mm256_loadu_pd(lv + 4 * g), LDR = _mm256_loadu_pd(ldr + 4 * g), LDW = _mm256_loadu_pd(ldw + 4 * g);
+					__m256d RL = _mm256_sub_pd(_mm256_add_pd(R[g],_mm256_mul_pd(_mm256_sub_pd(LV,V[g]),W[g])),LDR);
+					int groupActive = active >> (4 * g) & 0xf;
+					__m256i laneBits = _mm256_and_si256(_mm256_set1_epi64x(groupActive),_mm256_set_epi64x(8,4,2,1));
+					__m256d activeMask = _mm256_castsi256_pd(_mm256_cmpgt_epi64(laneBits,_mm256_setzero_si256()));
+					__m256d right = _mm256_and_pd(_mm256_cmp_pd(T[g],RL,_CMP_NLT_UQ),activeMask);
+					W[g] = _mm256_blendv_pd(W[g],_mm256_add_pd(W[g],LDW),right);
+					V[g] = _mm256_blendv_pd(V[g],LV,right);
+					R[g] = _mm256_blendv_pd(R[g],RL,right);
+					isRight |= _mm256_movemask_pd(right) << (4 * g);
+				}
+				moveDown(nodes,active,isRight,LANES);
+			}
+			for (int g = 0;g < 2;++ g)
+				_mm256_storeu_pd(out + i + 4 * g,_mm256_add_pd(V[g],_mm256_div_pd(_mm256_sub_pd(T[g],R[g]),W[g])));
+		}
+		descendSSE2(root,VTime,RTime,sumWeight,times + i,n - i,out + i);
+	}
+#endif
+	//! function to get the widest instruction set supported by the CPU
+	static LockstepISA bestISA()
+	{
+#ifdef LGPS_LOCKSTEP_X86
+		static const LockstepISA isa = __builtin_cpu_supports("avx2") ? LOCKSTEP_AVX2 :
+									   (__builtin_cpu_supports("sse2") ? LOCKSTEP_SSE2 : LOCKSTEP_SCALAR);
+		return isa;
+#else
+		return LOCKSTEP_SCALAR;
+#endif
+	}
+	//! function to answer the queries times[0..n-1] from the state (VTime, RTime, sumWeight)
+	/*! the tree must not be empty, and the widest kernel up to maxISA supported by the CPU is used
+	*/
+	static void descend(Node* root,double VTime,double RTime,double sumWeight,const double* times,size_t n,double* out,LockstepISA maxISA = LOCKSTEP_AVX2)
+	{
+		LockstepISA isa = maxISA < bestISA() ? maxISA : bestISA();
+#ifdef LGPS_LOCKSTEP_X86
+		if (isa == LOCKSTEP_AVX2)
+			return descendAVX2(root,VTime,RTime,sumWeight,times,n,out);
+		if (isa == LOCKSTEP_SSE2)
+			return descendSSE2(root,VTime,RTime,sumWeight,times,n,out);
+#endif
+		descendScalar(root,VTime,RTime,sumWeight,times,n,out);
+	}
+};
+
+#endif
@@ -0,0 +1,458 @@
+/*
+	Discrete-event simulator of a network of GPS links.
+
+	Every flow follows a route, i.e., a sequence of links, and the departure of a packet
+	from a link is its arrival at the next link of its route, after the propagation
+	delay of the link. Each link is backed by its own L_GPSSim (whose "real time" is the
+	amount of work served, i.e., the real time times the capacity) and serves its
+	packets with one of the following schedulers:
+		gps    fluid GPS, a packet leaves at its GPS real finish time
+		wfq    packet-by-packet GPS (WFQ): the packet with the smallest GPS virtual
+		       finish time is transmitted next
+		wf2q   WF2Q: the same, but among the packets which have started under GPS
+		       (i.e., whose virtual start time is no later than the virtual time)
+	The events (arrivals at links, ends of transmission, fluid departures) are kept in
+	a global binary heap ordered by time (ties in order of scheduling), so every event
+	costs O(log e + log n) for e pending events and n packets at the link.
+
+	The fluid departure of a packet is only known once the virtual time passes its
+	virtual finish time, since later arrivals slow the virtual clock down. Therefore a
+	gps link keeps one tentative departure event for its packet of smallest virtual
+	finish time, computed by L_GPSSim::VTime2RTime() as if no packet arrived any more.
+	As arrivals can only delay it, the event is checked when it fires and postponed if
+	necessary, and an arrival schedules a new event (making the pending one stale)
+	only if the new packet is to leave first.
+
+	Topology configuration file:
+		k <link ID> <capacity> <propagation delay> <scheduler>   declares a link
+		r <flow ID> <link ID> [<link ID> ...]                    route of a flow
+		c ...                                                    comments
+	Flow weights are the ones given in the packet trace, and they are the same on all
+	the links of the route.
+*/
+#ifndef L_GPS_NETWORK_HPP
+#define L_GPS_NETWORK_HPP
+
+#include <vector>
+#include <queue>
+#include <map>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cstdint>
+#include <algorithm> // for max
+#include <stdexcept> // for runtime_error
+
+#include "L_GPSsim.hpp"
+
+//! packet in transit in the network
+struct NetworkPacket{
+	//! packet of the trace
+	Packet *mpPacket;
+	//! index of the current link in the route of the flow
+	size_t mHop;
+	//! arrival time at the current link
+	double mArrivalTime;
+	//! GPS virtual start and finish times at the current link
+	double mVSTime;
+	double mVFTime;
+};
+
+//! compare class based on the virtual finish time of network packets (smallest first in a heap)
+class NPKT_Compare_VFT_G {
+   public:
+      bool operator()(const NetworkPacket* p1,const NetworkPacket* p2) { return p1->mVFTime > p2->mVFTime; }
+};
+//! compare class based on the virtual start time of network packets (smallest first in a heap)
+class NPKT_Compare_VST_G {
+   public:
+      bool operator()(const NetworkPacket* p1,const NetworkPacket* p2) { return p1->mVSTime > p2->mVSTime; }
+};
+
+//! record of the crossing of a link by a packet
+struct HopRecord{
+	Packet *mpPacket;
+	int mLinkId;
+	//! index of the link in the route of the flow
+	int mHop;
+	double mArrivalTime;
+	double mDepartureTime;
+	//! whether the link is the last one of the route
+	bool mIsLastHop;
+};
+
+//! class for a link of the network
+class NetworkLink{
+public:
+	enum Scheduler {GPS,WFQ,WF2Q};
+	int mLinkId;
+	//! amount of work (i.e., bytes) served per unit of time
+	double mCapacity;
+	double mPropagationDelay;
+	Scheduler mScheduler;
+	//! GPS simulator of this link
+	L_GPSSim *mpSimulator;
+	//! virtual finish time of the last packet of each flow on this link
+	std::vector<double> mFlowLastDepartVTimes;
+	//! packets waiting for their fluid departure or their transmission, by virtual finish time
+	std::priority_queue<NetworkPacket *,std::vector<NetworkPacket *>,NPKT_Compare_VFT_G> mQueue;
+	//! packets which have not started under GPS yet, by virtual start time (wf2q only)
+	std::priority_queue<NetworkPacket *,std::vector<NetworkPacket *>,NPKT_Compare_VST_G> mIneligible;
+	//! packet being transmitted (wfq and wf2q only)
+	NetworkPacket *mpTransmitted;
+	//! version and time of the tentative fluid departure event (gps only)
+	uint64_t mDepartureVersion;
+	double mDepartureTime;
+	//! statistics of the packets which left the link
+	size_t mPacketNum;
+	double mSumDelay;
+	double mMaxDelay;
+	//! constructor
+	NetworkLink(int linkId,double capacity,double propagationDelay,Scheduler scheduler,int flowNum)
+	{
+		if (capacity <= 0)
+			throw new std::runtime_error("Cannot create link with negative or zero capacity.");
+		if (propagationDelay < 0)
+			throw new std::runtime_error("Cannot create link with negative propagation delay.");
+		mLinkId = linkId;
+		mCapacity = capacity;
+		mPropagationDelay = propagationDelay;
+		mScheduler = scheduler;
+		mpSimulator = new L_GPSSim();
+		mFlowLastDepartVTimes.resize(flowNum);
+		mpTransmitted = NULL;
+		mDepartureVersion = 0;
+		mDepartureTime = std::numeric_limits<double>::infinity();
+		mPacketNum = 0;
+		mSumDelay = 0;
+		mMaxDelay = 0;
+	}
+	~NetworkLink()
+	{
+		delete mpSimulator;
+	}
+	//! get the number of packets at the link
+	size_t size()
+	{
+		return mQueue.size() + mIneligible.size() + (mpTransmitted != NULL ? 1 : 0);
+	}
+};
+
+//! class for the discrete-event simulator of a network of GPS links
+class L_GPSNetworkSim{
+	//! event of the simulation (40 bytes on 64-bit targets, the type is last to avoid padding)
+	struct Event{
+		enum Type {ARRIVAL,END_OF_TRANSMISSION,FLUID_DEPARTURE};
+		double mTime;
+		//! order of scheduling, to break ties
+		uint64_t mSequence;
+		NetworkLink *mpLink;
+		union{
+			//! arriving packet (ARRIVAL only)
+			NetworkPacket *mpPacket;
+			//! version of the tentative departure of the link when the event was scheduled (FLUID_DEPARTURE only)
+			uint64_t mVersion;
+		};
+		Type mType;
+	};
+	//! compare class of the events (earliest first in a heap)
+	struct Event_Compare_G{
+		bool operator()(const Event& e1,const Event& e2)
+		{
+			return e1.mTime > e2.mTime || (e1.mTime == e2.mTime && e1.mSequence > e2.mSequence);
+		}
+	};
+	//! links, indexed by link ID
+	std::map<int,NetworkLink *> mLinks;
+	//! weight of each flow
+	std::vector<double> mFlowWeights;
+	//! route of each flow
+	std::vector<std::vector<NetworkLink *> > mRoutes;
+	//! pending events
+	std::priority_queue<Event,std::vector<Event>,Event_Compare_G> mEvents;
+	uint64_t mSequence;
+	//! time of the last event
+	double mTime;
+	//! number of handled events
+	uint64_t mEventNum;
+	//! function to read the topology configuration
+	void readConfiguration(const std::string& conf)
+	{
+		std::ifstream infile(conf);
+		if (!infile.is_open())
+			throw new std::runtime_error("Cannot open topology configuration file.");
+		std::string lines, scheduler;
+		int linkId, flowId;
+		double capacity, propagationDelay;
+		char c;
+		while (infile >> c)
+		{
+			std::getline(infile,lines);
+			std::istringstream iss(lines);
+			switch(c)
+			{
+				case 'k':// link description
+					if (!(iss >> linkId >> capacity >> propagationDelay >> scheduler))
+						throw new std::runtime_error("Missing or wrong link description.");
+					if (mLinks.count(linkId))
+						throw new std::runtime_error("Duplicate link declaration.");
+					if (scheduler == "gps")
+						mLinks[linkId] = new NetworkLink(linkId,capacity,propagationDelay,NetworkLink::GPS,mFlowWeights.size());
+					else if (scheduler == "wfq")
+						mLinks[linkId] = new NetworkLink(linkId,capacity,propagationDelay,NetworkLink::WFQ,mFlowWeights.size());
+					else if (scheduler == "wf2q")
+						mLinks[linkId] = new NetworkLink(linkId,capacity,propagationDelay,NetworkLink::WF2Q,mFlowWeights.size());
+					else
+						throw new std::runtime_error("Unknown scheduler.");
+					break;
+				case 'r':// route of a flow
+					if (!(iss >> flowId))
+						throw new std::runtime_error("Missing or wrong route description.");
+					if (flowId < 1 || flowId > (int)mFlowWeights.size())
+						throw new std::runtime_error("Cannot route unknown flow.");
+					mRoutes[flowId - 1].clear();
+					while (iss >> linkId)
+					{
+						if (!mLinks.count(linkId))
+							throw new std::runtime_error("Cannot route flow through unknown link.");
+						mRoutes[flowId - 1].push_back(mLinks[linkId]);
+					}
+					if (mRoutes[flowId - 1].empty())
+						throw new std::runtime_error("Missing or wrong route description.");
+					break;
+				case 'c':// comments
+					break;
+				default:// unknown
+					throw new std::runtime_error("Unknown declaration.");
+			}
+		}
+	}
+	void schedule(double time,Event::Type type,NetworkLink* pLink,NetworkPacket* pPacket = NULL,uint64_t version = 0)
+	{
+		Event event;
+		event.mTime = time;
+		event.mSequence = mSequence ++;
+		event.mType = type;
+		event.mpLink = pLink;
+		if (type == Event::FLUID_DEPARTURE)
+			event.mVersion = version;
+		else
+			event.mpPacket = pPacket;
+		mEvents.push(event);
+	}
+	//! function to compute the fluid departure time of the packet of smallest virtual finish time of a gps link
+	double fluidDepartureTime(NetworkLink* pLink)
+	{
+		return std::max(pLink->mpSimulator->VTime2RTime(pLink->mQueue.top()->mVFTime) / pLink->mCapacity,mTime);
+	}
+	//! function to schedule the tentative fluid departure of a gps link at time departure, the pending one becomes stale
+	void scheduleFluidDeparture(NetworkLink* pLink,double departure)
+	{
+		++ pLink->mDepartureVersion;
+		pLink->mDepartureTime = departure;
+		schedule(departure,Event::FLUID_DEPARTURE,pLink,NULL,pLink->mDepartureVersion);
+	}
+	//! function to start the transmission of the next packet of an idle wfq or wf2q link
+	void startTransmission(NetworkLink* pLink)
+	{
+		if (pLink->mpTransmitted != NULL) return;
+		if (pLink->mScheduler == NetworkLink::WF2Q)
+		{//! the packets which have started under GPS become eligible (the first one anyway, so that the link is work-conserving)
+			double VTime = pLink->mpSimulator->RTime2VTime(mTime * pLink->mCapacity);
+			while (!pLink->mIneligible.empty() && (pLink->mIneligible.top()->mVSTime <= VTime || pLink->mQueue.empty()))
+			{
+				pLink->mQueue.push(pLink->mIneligible.top());
+				pLink->mIneligible.pop();
+			}
+		}
+		if (pLink->mQueue.empty()) return;
+		pLink->mpTransmitted = pLink->mQueue.top();
+		pLink->mQueue.pop();
+		schedule(mTime + pLink->mpTransmitted->mpPacket->mLength / pLink->mCapacity,Event::END_OF_TRANSMISSION,pLink);
+	}
+	//! function to handle the departure of a packet from a link, which sends it to the next link of its route
+	void depart(NetworkLink* pLink,NetworkPacket* pPacket,std::vector<HopRecord>& records)
+	{
+		const std::vector<NetworkLink *>& route = mRoutes[pPacket->mpPacket->mFlowId - 1];
+		double delay = mTime - pPacket->mArrivalTime;
+		++ pLink->mPacketNum;
+		pLink->mSumDelay += delay;
+		pLink->mMaxDelay = std::max(pLink->mMaxDelay,delay);
+
+		HopRecord record;
+		record.mpPacket = pPacket->mpPacket;
+		record.mLinkId = pLink->mLinkId;
+		record.mHop = (int)pPacket->mHop;
+		record.mArrivalTime = pPacket->mArrivalTime;
+		record.mDepartureTime = mTime;
+		record.mIsLastHop = pPacket->mHop + 1 == route.size();
+		records.push_back(record);
+
+		if (record.mIsLastHop)
+			delete pPacket;
+		else
+		{
+			++ pPacket->mHop;
+			schedule(mTime + pLink->mPropagationDelay,Event::ARRIVAL,route[pPacket->mHop],pPacket);
+		}
+	}
+	//! function to handle the arrival of a packet at a link
+	void arrive(NetworkLink* pLink,NetworkPacket* pPacket)
+	{
+		Packet *pPKT = pPacket->mpPacket;
+		double& flowLastDepartVTime = pLink->mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+		double flowWeight = mFlowWeights[pPKT->mFlowId - 1];
+		double curVTime;
+		pPacket->mArrivalTime = mTime;
+		pPacket->mVFTime = pLink->mpSimulator->HandleNewArrival(mTime * pLink->mCapacity,pPKT->mLength,flowWeight,flowLastDepartVTime,&curVTime);
+		pPacket->mVSTime = pPacket->mVFTime - pPKT->mLength / flowWeight;
+		switch (pLink->mScheduler)
+		{
+			case NetworkLink::GPS:
+			{
+				pLink->mQueue.push(pPacket);
+				//! the pending event is early enough, unless the new packet is to leave first
+				double departure = fluidDepartureTime(pLink);
+				if (departure < pLink->mDepartureTime)
+					scheduleFluidDeparture(pLink,departure);
+				break;
+			}
+			case NetworkLink::WFQ:
+				pLink->mQueue.push(pPacket);
+				startTransmission(pLink);
+				break;
+			case NetworkLink::WF2Q:
+				pLink->mIneligible.push(pPacket);
+				startTransmission(pLink);
+				break;
+		}
+	}
+	//! function to handle the next event
+	void handleEvent(std::vector<HopRecord>& records)
+	{
+		Event event = mEvents.top();
+		mEvents.pop();
+		mTime = event.mTime;
+		++ mEventNum;
+		NetworkLink *pLink = event.mpLink;
+		switch (event.mType)
+		{
+			case Event::ARRIVAL:
+				arrive(pLink,event.mpPacket);
+				break;
+			case Event::END_OF_TRANSMISSION:
+			{
+				NetworkPacket *pPacket = pLink->mpTransmitted;
+				pLink->mpTransmitted = NULL;
+				depart(pLink,pPacket,records);
+				startTransmission(pLink);
+				break;
+			}
+			case Event::FLUID_DEPARTURE:
+			{
+				if (event.mVersion != pLink->mDepartureVersion) break;//! replaced by an earlier departure
+				//! the packets which arrived meanwhile may have delayed the departure
+				double departure = fluidDepartureTime(pLink);
+				if (departure > mTime)
+				{
+					scheduleFluidDeparture(pLink,departure);
+					break;
+				}
+				NetworkPacket *pPacket = pLink->mQueue.top();
+				pLink->mQueue.pop();
+				depart(pLink,pPacket,records);
+				if (pLink->mQueue.empty())
+					pLink->mDepartureTime = std::numeric_limits<double>::infinity();
+				else
+					scheduleFluidDeparture(pLink,fluidDepartureTime(pLink));
+				break;
+			}
+		}
+	}
+public:
+	//! constructor
+	/*! conf is the path of the topology configuration file
+	*/
+	L_GPSNetworkSim(const std::vector<double>& flowWeights,const std::string& conf)
+	{
+		mFlowWeights = flowWeights;
+		mRoutes.resize(flowWeights.size());
+		mSequence = 0;
+		mTime = 0;
+		mEventNum = 0;
+		try{
+			readConfiguration(conf);
+		}
+		catch(...)
+		{
+			for (auto& l: mLinks)
+				delete l.second;
+			throw;
+		}
+	}
+	~L_GPSNetworkSim()
+	{
+		while (!mEvents.empty())
+		{
+			if (mEvents.top().mType == Event::ARRIVAL)
+				delete mEvents.top().mpPacket;
+			mEvents.pop();
+		}
+		for (auto& l: mLinks)
+		{
+			NetworkLink *pLink = l.second;
+			for (;!pLink->mQueue.empty();pLink->mQueue.pop())
+				delete pLink->mQueue.top();
+			for (;!pLink->mIneligible.empty();pLink->mIneligible.pop())
+				delete pLink->mIneligible.top();
+			delete pLink->mpTransmitted;
+			delete pLink;
+		}
+	}
+	//! function to move the time forward to newTime, the crossings of links completed by then are appended to records
+	void AdvanceTo(double newTime,std::vector<HopRecord>& records)
+	{
+		while (!mEvents.empty() && mEvents.top().mTime <= newTime)
+			handleEvent(records);
+		mTime = std::max(mTime,newTime);
+	}
+	//! function to handle the arrival of a packet at the first link of its route (packets must arrive in order of arrival time)
+	/*! the crossings of links completed before its arrival are appended to records first
+		(see AdvanceTo())
+	*/
+	void HandleNewPacketArrival(Packet* pPKT,std::vector<HopRecord>& records)
+	{
+		if (pPKT->mArrivalTime < mTime)
+			throw new std::runtime_error("Packets must arrive in order of arrival time.");
+		if (pPKT->mFlowId < 1 || pPKT->mFlowId > (int)mRoutes.size() || mRoutes[pPKT->mFlowId - 1].empty())
+			throw new std::runtime_error("Cannot send packet of a flow without route.");
+		//! the events at the arrival time are handled after it, as if it was scheduled first
+		while (!mEvents.empty() && mEvents.top().mTime < pPKT->mArrivalTime)
+			handleEvent(records);
+		mTime = pPKT->mArrivalTime;
+		NetworkPacket *pPacket = new NetworkPacket();
+		pPacket->mpPacket = pPKT;
+		pPacket->mHop = 0;
+		++ mEventNum;
+		arrive(mRoutes[pPKT->mFlowId - 1][0],pPacket);
+	}
+	//! function to handle all the remaining events, when no packet arrives any more
+	void Finish(std::vector<HopRecord>& records)
+	{
+		while (!mEvents.empty())
+			handleEvent(records);
+	}
+	//! get the links, by link ID
+	const std::map<int,NetworkLink *>& GetLinks()
+	{
+		return mLinks;
+	}
+	//! get the number of handled events
+	uint64_t GetEventNum()
+	{
+		return mEventNum;
+	}
+};
+
+#endif
@@ -0,0 +1,481 @@
+/*
+	L-GPS simulator on a persistent (path-copying) tree, for concurrent readers.
+
+	The break points are kept in a leaf-oriented AVL tree with the same aggregates as
+	the one of L_GPSSim (see L_GPSAugmentation), but the published nodes are never
+	modified: an update copies the nodes on its path (and the ones it rotates) and
+	shares all the others with the previous version. After every arrival (i.e., once
+	both of its break points are appended) the simulator publishes an immutable
+	snapshot (root of the new version and state of the virtual clock) through an
+	atomic pointer, so monitoring threads can query the virtual time and the backlog
+	lock-free while the simulator thread keeps going, and never see the state between
+	the two updates of an arrival.
+
+	The replaced nodes and snapshots are freed by epoch-based reclamation: a reader
+	announces the global epoch before it loads the snapshot, and everything retired
+	at epoch e is freed once no active reader announced an epoch no greater than e.
+
+	One thread (the simulator thread) calls HandleNewPacketArrival(), any number of
+	threads (up to MAX_READERS at a time) read through an L_GPSSnapshotReader.
+*/
+#ifndef L_GPS_PERSISTENT_HPP
+#define L_GPS_PERSISTENT_HPP
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <cstdint>
+#include <cmath> // for fabs
+#include <stdexcept> // for runtime_error
+
+#include "L_GPSsim.hpp"
+
+//! node of the persistent tree of break points
+struct PersistentNode{
+	DataField data;
+	PersistentNode *left;
+	PersistentNode *right;
+	int height;
+	//! version of the tree which created the node, only the nodes of the version being built may be modified
+	uint64_t mVersion;
+};
+
+//! immutable snapshot of the simulator, published after every Append()
+struct L_GPSSnapshot{
+	//! root of the tree of break points of this version (NULL if empty)
+	const PersistentNode *mpRoot;
+	//! virtual time, real time and total weight after the last event (see L_GPSSim)
+	double mOldVTime;
+	double mOldRTime;
+	double mSumWeight;
+	//! number of break points
+	size_t mBreakPointNum;
+};
+
+//! result of a query on a snapshot
+struct L_GPSSnapshotView{
+	//! virtual time at the real time of the query
+	double mVTime;
+	//! total weight of the backlogged flows at the real time of the query
+	double mSumWeight;
+	//! number of break points of the snapshot
+	size_t mBreakPointNum;
+};
+
+class L_GPSSnapshotReader;
+
+//! class for the L-GPS simulator publishing immutable snapshots
+class L_GPSSnapshotSim{
+	friend class L_GPSSnapshotReader;
+public:
+	//! maximum number of readers at the same time
+	static const int MAX_READERS = 64;
+private:
+	//! state of the simulator thread (see L_GPSSim)
+	double mOldVTime;
+	double mOldRTime;
+	double mSumWeight;
+	PersistentNode *mpRoot;
+	size_t mSize;
+	//! version being built, i.e., the number of published snapshots plus one
+	uint64_t mVersion;
+	//! latest snapshot
+	std::atomic<L_GPSSnapshot*> mpSnapshot;
+
+	//! global epoch, and the epoch announced by every reader slot (0 if the slot is not reading)
+	std::atomic<uint64_t> mEpoch;
+	std::atomic<uint64_t> mReaderEpochs[MAX_READERS];
+	std::atomic<bool> mIsSlotUsed[MAX_READERS];
+	//! nodes and snapshots retired at the same epoch
+	struct RetiredBatch{
+		uint64_t mEpoch;
+		std::vector<PersistentNode*> mNodes;
+		L_GPSSnapshot *mpSnapshot;
+	};
+	std::deque<RetiredBatch> mRetired;
+	//! nodes replaced by the version being built
+	std::vector<PersistentNode*> mRetiring;
+
+	static int height(const PersistentNode* current)
+	{
+		return current == NULL ? -1 : current->height;
+	}
+	static bool IsLeaf(const PersistentNode* current)
+	{
+		return current->left == NULL;
+	}
+	PersistentNode* newNode(const DataField& data,PersistentNode* left,PersistentNode* right)
+	{
+		PersistentNode *current = new PersistentNode;
+		current->data = data;
+		current->left = left;
+		current->right = right;
+		current->height = 0;
+		current->mVersion = mVersion;
+		update(current);
+		return current;
+	}
+	//! function to get a modifiable copy of current in the version being built (the node itself if it belongs to it)
+	PersistentNode* own(PersistentNode* current)
+	{
+		if (current->mVersion == mVersion) return current;
+		PersistentNode *copy = new PersistentNode(*current);
+		copy->mVersion = mVersion;
+		mRetiring.push_back(current);
+		return copy;
+	}
+	//! function to drop a node from the version being built
+	void discard(PersistentNode* current)
+	{
+		if (current->mVersion == mVersion)
+			delete current;
+		else
+			mRetiring.push_back(current);
+	}
+	//! function to recompute the height and the aggregates of a node of the version being built
+	static void update(PersistentNode* current)
+	{
+		if (IsLeaf(current)) return;
+		current->height = std::max(height(current->left),height(current->right)) + 1;
+		L_GPSAugmentation::combine(current->data,current->left->data,current->right->data);
+	}
+	PersistentNode* rotateRight(PersistentNode* current)
+	{
+		PersistentNode *left = own(current->left);
+		current->left = left->right;
+		left->right = current;
+		update(current);
+		update(left);
+		return left;
+	}
+	PersistentNode* rotateLeft(PersistentNode* current)
+	{
+		PersistentNode *right = own(current->right);
+		current->right = right->left;
+		right->left = current;
+		update(current);
+		update(right);
+		return right;
+	}
+	//! function to rebalance a node of the version being built, returns the new root of its subtree
+	PersistentNode* rebalance(PersistentNode* current)
+	{
+		int balance = height(current->left) - height(current->right);
+		if (balance > 1)
+		{
+			PersistentNode *left = current->left;
+			if (height(left->left) < height(left->right))
+				current->left = rotateLeft(own(left));
+			return rotateRight(current);
+		}
+		if (balance < -1)
+		{
+			PersistentNode *right = current->right;
+			if (height(right->right) < height(right->left))
+				current->right = rotateRight(own(right));
+			return rotateLeft(current);
+		}
+		return current;
+	}
+	//! function to insert data in the subtree rooted at current, merging it with the leaf of the same key
+	/*! returns the root of the new version of the subtree, NULL if its only leaf became void
+	*/
+	PersistentNode* insert(PersistentNode* current,const DataField& data)
+	{
+		Compare_VTM_L less;
+		if (current == NULL)
+		{
+			++ mSize;
+			return newNode(data,NULL,NULL);
+		}
+		if (IsLeaf(current))
+		{//! the old leaf is shared by the new version
+			if (less(data,current->data))
+			{
+				++ mSize;
+				return newNode(current->data,newNode(data,NULL,NULL),current);
+			}
+			if (less(current->data,data))
+			{
+				++ mSize;
+				return newNode(data,current,newNode(data,NULL,NULL));
+			}
+			PersistentNode *leaf = own(current);
+			L_GPSAugmentation::merge(leaf->data,data);
+			if (!L_GPSAugmentation::isVoid(leaf->data)) return leaf;
+			discard(leaf);
+			-- mSize;
+			return NULL;
+		}
+		//! the key of an internal node is the maximum of its subtree, hence compare with the left subtree
+		bool isLeft = !less(current->left->data,data);
+		PersistentNode *child = insert(isLeft ? current->left : current->right,data);
+		if (child == NULL)
+		{//! the sibling takes the place of the node
+			PersistentNode *sibling = isLeft ? current->right : current->left;
+			discard(current);
+			return sibling;
+		}
+		current = own(current);
+		if (isLeft)
+			current->left = child;
+		else
+			current->right = child;
+		update(current);
+		return rebalance(current);
+	}
+	//! function to remove the leftmost leaf of the subtree rooted at current, which data receives
+	PersistentNode* removeMin(PersistentNode* current,DataField& data)
+	{
+		if (IsLeaf(current))
+		{
+			data = current->data;
+			discard(current);
+			-- mSize;
+			return NULL;
+		}
+		PersistentNode *left = removeMin(current->left,data);
+		if (left == NULL)
+		{
+			PersistentNode *right = current->right;
+			discard(current);
+			return right;
+		}
+		current = own(current);
+		current->left = left;
+		update(current);
+		return rebalance(current);
+	}
+	//! function to retire all the nodes of the subtree rooted at current
+	void retireAll(PersistentNode* current)
+	{
+		if (current == NULL) return;
+		retireAll(current->left);
+		retireAll(current->right);
+		discard(current);
+	}
+	//! function to free the subtree rooted at current (no reader may use it any more)
+	static void freeAll(PersistentNode* current)
+	{
+		if (current == NULL) return;
+		freeAll(current->left);
+		freeAll(current->right);
+		delete current;
+	}
+	//! function to publish the version being built and to free what no reader can reach any more
+	void Publish()
+	{
+		L_GPSSnapshot *pSnapshot = new L_GPSSnapshot;
+		pSnapshot->mpRoot = mpRoot;
+		pSnapshot->mOldVTime = mOldVTime;
+		pSnapshot->mOldRTime = mOldRTime;
+		pSnapshot->mSumWeight = mSumWeight;
+		pSnapshot->mBreakPointNum = mSize;
+		L_GPSSnapshot *pOld = mpSnapshot.exchange(pSnapshot);
+
+		RetiredBatch batch;
+		batch.mEpoch = mEpoch.fetch_add(1);
+		batch.mNodes.swap(mRetiring);
+		batch.mpSnapshot = pOld;
+		mRetired.push_back(std::move(batch));
+		++ mVersion;
+		Reclaim();
+	}
+	//! function to free the batches retired before the epoch of every active reader
+	void Reclaim()
+	{
+		uint64_t minEpoch = mEpoch.load();
+		for (int i = 0;i < MAX_READERS;++ i)
+		{
+			uint64_t epoch = mReaderEpochs[i].load();
+			if (epoch != 0 && epoch < minEpoch)
+				minEpoch = epoch;
+		}
+		while (!mRetired.empty() && mRetired.front().mEpoch < minEpoch)
+		{
+			for (auto pNode: mRetired.front().mNodes)
+				delete pNode;
+			delete mRetired.front().mpSnapshot;
+			mRetired.pop_front();
+		}
+	}
+	//! function to compute the virtual time and the total weight at real time NewRTime in a snapshot
+	static L_GPSSnapshotView Query(const L_GPSSnapshot* pSnapshot,double NewRTime)
+	{
+		double oldVTime = pSnapshot->mOldVTime,
+			   oldRTime = pSnapshot->mOldRTime,
+			   oldSumWeight = pSnapshot->mSumWeight;
+		double eps = 1e-8;
+		L_GPSSnapshotView view;
+		view.mBreakPointNum = pSnapshot->mBreakPointNum;
+		const PersistentNode *pCurNode = pSnapshot->mpRoot;
+		if (pCurNode != NULL && std::fabs(oldSumWeight) > eps)
+		{
+			while (!IsLeaf(pCurNode))
+			{
+				double RTimeLMax = oldRTime + (pCurNode->left->data.mVTimeMax - oldVTime) * oldSumWeight - pCurNode->left->data.mDeltaRTime;
+				if (NewRTime < RTimeLMax)
+					pCurNode = pCurNode->left;
+				else
+				{
+					oldSumWeight += pCurNode->left->data.mDeltaWeight;
+					oldVTime = pCurNode->left->data.mVTimeMax;
+					oldRTime = RTimeLMax;
+					pCurNode = pCurNode->right;
+				}
+			}
+			view.mVTime = oldVTime + (NewRTime - oldRTime) / oldSumWeight;
+		}
+		else
+			view.mVTime = oldVTime;
+		view.mSumWeight = oldSumWeight;
+		return view;
+	}
+	//! function to restart the virtual clock if the server is idle at time newRTime (see L_GPSSim::RestartIfIdle())
+	void RestartIfIdle(double newRTime)
+	{
+		double eps = 1e-8;
+		if (mpRoot == NULL)
+		{
+			if (std::fabs(mSumWeight) <= eps)
+			{
+				mOldRTime = newRTime;
+				mSumWeight = 0;
+			}
+			return;
+		}
+		if (std::fabs(mSumWeight + mpRoot->data.mDeltaWeight) > eps) return;
+		double lastRTime = mOldRTime + (mpRoot->data.mVTimeMax - mOldVTime) * mSumWeight - mpRoot->data.mDeltaRTime;
+		if (newRTime < lastRTime) return;
+
+		mOldVTime = mpRoot->data.mVTimeMax;
+		mOldRTime = newRTime;
+		mSumWeight = 0;
+		retireAll(mpRoot);
+		mpRoot = NULL;
+		mSize = 0;
+	}
+	//! function to insert a break point and to remove all the passed ones in the version being built (see L_GPSSim::Append())
+	void Append(double curVTime,double newVTime,double newDeltaWeight)
+	{
+		mpRoot = insert(mpRoot,DataField(newVTime,newDeltaWeight));
+		while (true)
+		{
+			PersistentNode *pLeftmost = mpRoot;
+			while (pLeftmost != NULL && !IsLeaf(pLeftmost))
+				pLeftmost = pLeftmost->left;
+			if (pLeftmost == NULL || curVTime < pLeftmost->data.mVTimeMax) break;
+			DataField data;
+			mpRoot = removeMin(mpRoot,data);
+			mOldRTime += mSumWeight * (data.mVTimeMax - mOldVTime);
+			mOldVTime = data.mVTimeMax;
+			mSumWeight += data.mDeltaWeight;
+		}
+	}
+public:
+	//! constructor
+	L_GPSSnapshotSim()
+	{
+		mOldVTime = 0;
+		mOldRTime = 0;
+		mSumWeight = 0;
+		mpRoot = NULL;
+		mSize = 0;
+		mVersion = 1;
+		mEpoch = 1;
+		for (int i = 0;i < MAX_READERS;++ i)
+		{
+			mReaderEpochs[i] = 0;
+			mIsSlotUsed[i] = false;
+		}
+		L_GPSSnapshot *pSnapshot = new L_GPSSnapshot;
+		pSnapshot->mpRoot = NULL;
+		pSnapshot->mOldVTime = pSnapshot->mOldRTime = pSnapshot->mSumWeight = 0;
+		pSnapshot->mBreakPointNum = 0;
+		mpSnapshot = pSnapshot;
+	}
+	//! destructor, no reader may be active
+	~L_GPSSnapshotSim()
+	{
+		for (auto& batch: mRetired)
+		{
+			for (auto pNode: batch.mNodes)
+				delete pNode;
+			delete batch.mpSnapshot;
+		}
+		for (auto pNode: mRetiring)
+			delete pNode;
+		freeAll(mpRoot);
+		delete mpSnapshot.load();
+	}
+	//! function to handle the event of packet arrival (see L_GPSSim::HandleNewPacketArrival()), simulator thread only
+	/*! the arrival break point of a backlogged flow is merged into the expected break
+		point of its previous packet, which is dropped as it becomes void, so that the
+		tree keeps one break point per backlogged flow as in L_GPSSim
+	*/
+	double HandleNewPacketArrival(Packet* pPKT,double flowWeight,double& flowLastDepartVTime)
+	{
+		double newRTime = pPKT->mArrivalTime;
+		RestartIfIdle(newRTime);
+		L_GPSSnapshot current;
+		current.mpRoot = mpRoot;
+		current.mOldVTime = mOldVTime;
+		current.mOldRTime = mOldRTime;
+		current.mSumWeight = mSumWeight;
+		current.mBreakPointNum = mSize;
+		double curVTime = Query(&current,newRTime).mVTime;
+		double newVTime = curVTime;
+		if (newVTime < flowLastDepartVTime)
+			newVTime = flowLastDepartVTime;
+		double newExpectedBreakPoint = newVTime + pPKT->mLength / flowWeight;
+		flowLastDepartVTime = newExpectedBreakPoint;
+		Append(curVTime,newVTime,flowWeight);
+		Append(curVTime,newExpectedBreakPoint,-flowWeight);
+		Publish();
+		return newExpectedBreakPoint;
+	}
+	//! get the number of break points of the version being built
+	size_t size()
+	{
+		return mSize;
+	}
+};
+
+//! class for a reader of the snapshots of an L_GPSSnapshotSim, to be used by one thread
+/*! the reader takes one of the MAX_READERS slots for its lifetime
+*/
+class L_GPSSnapshotReader{
+	L_GPSSnapshotSim& mSim;
+	int mSlot;
+public:
+	explicit L_GPSSnapshotReader(L_GPSSnapshotSim& sim):mSim(sim)
+	{
+		for (mSlot = 0;mSlot < L_GPSSnapshotSim::MAX_READERS;++ mSlot)
+		{
+			bool isUsed = false;
+			if (mSim.mIsSlotUsed[mSlot].compare_exchange_strong(isUsed,true))
+				return;
+		}
+		throw new std::runtime_error("Too many snapshot readers.");
+	}
+	~L_GPSSnapshotReader()
+	{
+		mSim.mIsSlotUsed[mSlot] = false;
+	}
+	//! function to query the latest snapshot at real time NewRTime, lock-free
+	L_GPSSnapshotView Query(double NewRTime)
+	{
+		//! announce the epoch before loading the snapshot, so that nothing reachable from it is freed
+		mSim.mReaderEpochs[mSlot].store(mSim.mEpoch.load());
+		L_GPSSnapshotView view = L_GPSSnapshotSim::Query(mSim.mpSnapshot.load(),NewRTime);
+		mSim.mReaderEpochs[mSlot].store(0);
+		return view;
+	}
+	//! function to compute the virtual time at real time NewRTime on the latest snapshot
+	double RTime2VTime(double NewRTime)
+	{
+		return Query(NewRTime).mVTime;
+	}
+};
+
+#endif
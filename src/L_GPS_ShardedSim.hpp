@@ -0,0 +1,141 @@
+/*
+	Multi-port GPS simulation.
+
+	A switch has many output ports and each of them is an independent GPS server,
+	therefore the simulation can be sharded by port: every shard owns its own L_GPSSim
+	(and the per-flow virtual finish times of its last packets), and different shards
+	are simulated in parallel on a work-stealing thread pool. Packets of the same
+	shard are always handled by one task in arrival order, so the output of every
+	shard is exactly the same as the one of a single-port simulation.
+*/
+#ifndef L_GPS_SHARDED_SIM_HPP
+#define L_GPS_SHARDED_SIM_HPP
+
+#include <vector>
+#include <map>
+#include <algorithm> // for sort
+#include <stdexcept> // for runtime_error
+
+#include "L_GPSsim.hpp"
+#include "threadPool.hpp"
+
+//! class for one shard (i.e., output port) of the multi-port simulation
+class L_GPSShard{
+public:
+	//! port this shard simulates
+	int mPortId;
+	//! GPS simulator of this port
+	L_GPSSim *mpSimulator;
+	//! packets sent to this port, in arrival order
+	std::vector<Packet *> mPackets;
+	//! virtual finish time of the last packet of each flow on this port
+	std::vector<double> mFlowLastDepartVTimes;
+	//! number of packets (at the front of mPackets) already simulated
+	size_t mHandledNum;
+	//! constructor
+	L_GPSShard(int portId,int flowNum)
+	{
+		mPortId = portId;
+		mpSimulator = new L_GPSSim();
+		mFlowLastDepartVTimes.resize(flowNum);
+		mHandledNum = 0;
+	}
+	~L_GPSShard()
+	{
+		delete mpSimulator;
+	}
+	//! function to simulate the packets of this shard which are not simulated yet
+	void run(const std::vector<double>& flowWeights)
+	{
+		for (;mHandledNum < mPackets.size();++ mHandledNum)
+		{
+			Packet *pPKT = mPackets[mHandledNum];
+			double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+			pPKT->mGPS_VFTime = mpSimulator->HandleNewPacketArrival(pPKT,flowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+		}
+	}
+};
+
+//! class for a multi-port GPS simulator with one L_GPSSim per port
+class L_GPSShardedSim{
+	//! weight of each flow (shared by all the ports)
+	std::vector<double> mFlowWeights;
+	//! shards ordered by port
+	std::vector<L_GPSShard *> mShards;
+	//! map from port to the index of its shard
+	std::map<int,int> mPort2Shard;
+	//! thread pool running the shards
+	WorkStealingPool *mpPool;
+public:
+	//! constructor
+	/*! threadNum = 0 means one thread per hardware thread
+	*/
+	L_GPSShardedSim(const std::vector<double>& flowWeights,unsigned threadNum = 0)
+	{
+		mFlowWeights = flowWeights;
+		mpPool = new WorkStealingPool(threadNum);
+	}
+	~L_GPSShardedSim()
+	{
+		delete mpPool;
+		for (auto s: mShards)
+			delete s;
+	}
+	//! function to route packets to their shards
+	/*! packets must be given in arrival order (also across calls), and the order is
+		kept inside every shard. The packets of a port routed by several calls go to the
+		same shard.
+	*/
+	void route(const std::vector<Packet *>& packets)
+	{
+		for (auto pPKT: packets)
+			if (pPKT->mFlowId < 1 || pPKT->mFlowId > (int)mFlowWeights.size())
+				throw new std::runtime_error("Packet belongs to an unknown flow.");
+		//! only the ports without shard are added
+		size_t shardNum = mShards.size();
+		for (auto pPKT: packets)
+			mPort2Shard.emplace(pPKT->mPortId,-1);
+		for (auto& p: mPort2Shard)
+		{
+			if (p.second >= 0) continue;
+			p.second = mShards.size();
+			mShards.push_back(new L_GPSShard(p.first,mFlowWeights.size()));
+		}
+		//! keep the shards in port order, so that the output is deterministic
+		if (mShards.size() > shardNum)
+		{
+			std::sort(mShards.begin(),mShards.end(),[](const L_GPSShard *s1,const L_GPSShard *s2){ return s1->mPortId < s2->mPortId; });
+			for (size_t i = 0;i < mShards.size();++ i)
+				mPort2Shard[mShards[i]->mPortId] = i;
+		}
+		for (auto pPKT: packets)
+			mShards[mPort2Shard[pPKT->mPortId]]->mPackets.push_back(pPKT);
+	}
+	//! function to simulate in parallel the packets routed since the last call
+	void run()
+	{
+		//! submit the largest shards first, so that they do not become the stragglers
+		std::vector<L_GPSShard *> order(mShards);
+		std::sort(order.begin(),order.end(),[](const L_GPSShard *s1,const L_GPSShard *s2){ return s1->mPackets.size() - s1->mHandledNum > s2->mPackets.size() - s2->mHandledNum; });
+		for (auto s: order)
+		{
+			std::vector<double>& weights = mFlowWeights;
+			mpPool->submit([s,&weights]{ s->run(weights); });
+		}
+		mpPool->wait();
+	}
+	//! get the shards, ordered by port
+	std::vector<L_GPSShard *>& GetShards()
+	{
+		return mShards;
+	}
+	//! get the shard of a given port (NULL if no packet was sent to it)
+	L_GPSShard* GetShard(int portId)
+	{
+		auto it = mPort2Shard.find(portId);
+		if (it == mPort2Shard.end()) return NULL;
+		return mShards[it->second];
+	}
+};
+
+#endif
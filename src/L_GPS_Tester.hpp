@@ -5,137 +5,111 @@
 #include <fstream>
 #include <vector>
 #include <string> // for string & getline
+#include <thread>
+#include <exception> // for exception_ptr
+#include <memory> // for unique_ptr
+#include <limits>
 
 //#include "packet.hpp"
 #include "L_GPSsim.hpp" // for Packet, Flow, GPSSim 
+#include "L_GPS_ShardedSim.hpp"
+#include "L_HGPSsim.hpp"
+#include "L_GPS_Departures.hpp"
+#include "L_GPS_Network.hpp"
+#include "traceReader.hpp"
+#include "boundedQueue.hpp"
+#include "arrivalSort.hpp"
+#include "externalSort.hpp"
 #include "json.hpp"
 
 using json = nlohmann::json;
 //! packet scheduler class
 class L_GPS_Tester{
     L_GPSSim *L_GPSsimulator;
+    //! path of the input file
+    std::string mInput;
     //! vector for Packets
     std::vector<Packet *> mPackets;
+    //! whether the packets were loaded by the constructor
+    bool mArePacketsLoaded;
     std::vector<double> mFlowWeights;
 	std::vector<double> mFlowLastDepartVTimes;
     json Packet2JSON(int i)
     {
        assert(i >=0 && i < mPackets.size());
+       return Packet2JSON(mPackets[i]);
+    }
+    json Packet2JSON(Packet *pPKT)
+    {
        json j = {
-        {"flowId",mPackets[i]->mFlowId},
-        {"packetId",mPackets[i]->mPacketId},
-        {"arrivalTime",mPackets[i]->mArrivalTime},
-        {"packetLength",mPackets[i]->mLength},
-        {"virtualFinishTime",mPackets[i]->mGPS_VFTime}
+        {"flowId",pPKT->mFlowId},
+        {"packetId",pPKT->mPacketId},
+        {"arrivalTime",pPKT->mArrivalTime},
+        {"packetLength",pPKT->mLength},
+        {"virtualFinishTime",pPKT->mGPS_VFTime}
        };
        return j;
     }
+    //! functions to save results packet by packet (in the same format as save2JSON())
+    void beginStreamJSON(std::ofstream& ofs)
+    {
+        json jFlows;
+        jFlows.push_back(json(mFlowWeights));
+        ofs << "{\"flow_weights\":" << jFlows.dump() << ",\"packets\":[";
+    }
+    void streamPacket2JSON(std::ofstream& ofs,Packet *pPKT,bool& isFirst)
+    {
+        if (!isFirst) ofs << ",";
+        isFirst = false;
+        ofs << Packet2JSON(pPKT).dump();
+    }
+    void streamDeparture2JSON(std::ofstream& ofs,Packet *pPKT,bool& isFirst)
+    {
+        if (!isFirst) ofs << ",";
+        isFirst = false;
+        json j = Packet2JSON(pPKT);
+        j["realFinishTime"] = pPKT->mGPS_RFTime;
+        ofs << j.dump();
+    }
+    void endStreamJSON(std::ofstream& ofs)
+    {
+        ofs << "]}" << std::endl;
+        ofs.close();
+    }
+    //! function to free a batch of packets
+    static void deleteBatch(std::vector<Packet *>* pBatch)
+    {
+        for (auto pPKT: *pBatch)
+            delete pPKT;
+        delete pBatch;
+    }
 public:
     //! constructor
-    L_GPS_Tester(std::string input){
-        // input file stream
-        std::ifstream infile;
-        std::string lines;
-        
-        
-        int flowNum = -1;
-        std::string flowWeightConf;
-        bool isEqualWeight;
-        double flowWeight;
-        int flowId, packetId, packetLength;
-        long int arrivalTime;
-        char c;
-        
+    /*! if loadPackets is false, only the flow configuration is read, and the packets
+        are streamed from the input file by runPipelined() or runExternal(), which 
+        require it; otherwise the packets are parsed and sorted by parseThreads threads
+        (0 means one thread per hardware thread)
+    */
+    L_GPS_Tester(std::string input,bool loadPackets = true,unsigned parseThreads = 1){
+        mInput = input;
+        mArePacketsLoaded = loadPackets;
         // start processing input file
         try {
             
-            //! open the file
-            infile.open (input);
-            
-            //! try to read flow configuration
-            while (infile >> c)
-            {
-                switch(c)
-                {
-                    case 'f':// flow description
-                        if(infile >> flowNum >> flowWeightConf)
-                        {
-                            std::getline(infile, lines);// pass through this line
-                            if(flowWeightConf=="eq") isEqualWeight = true;
-                            else if(flowWeightConf=="neq") isEqualWeight = false;
-                            else throw new std::runtime_error("Unknown flow flowWeight configuration.");
-                        }
-                        else
-                        {
-                            throw new std::runtime_error("Missing or wrong flow configuration.");
-                        }
-                        break;
-                    case 'c':// comments
-                        std::getline(infile, lines);// skip this line
-                        break;
-                    default:// unknown
-                        throw new std::runtime_error("Unknown declaration.");
-                }
-                if (flowNum > 0) break;
-            }
+            //! open the file and read the flow configuration
+            TraceReader reader(input);
+            mFlowWeights = reader.GetFlowWeights();
             
-            if (!isEqualWeight)
-            {// read flow weights
-                while (infile >> c)
-                {
-                    switch(c)
-                    {
-                        case 'w':// weights line
-                        {
-                            while (mFlowWeights.size() < flowNum && infile >> flowWeight)
-                                mFlowWeights.push_back(flowWeight);
-                            std::getline(infile,lines);
-                            if (mFlowWeights.size() < flowNum)
-                                throw new std::runtime_error("Missing or wrong flow flowWeight configuration");
-                            break;
-                        }
-                        case 'c':
-                            std::getline(infile,lines);
-                            break;
-                        default:
-                            throw new std::runtime_error("Unknown declaration.");
-                    }
-                    
-                    if (mFlowWeights.size() == flowNum)// jump out the while loop
-                        break;
-                }
-            }
+            // readmPackets
+            Packet *p;
+            if (loadPackets && parseThreads != 1)
+                reader.readAllParallel(mPackets,parseThreads);
             else
-            {
-                for (int i = 0;i < flowNum;++ i)
-                    mFlowWeights.push_back(1.0);
-            }
+                while (loadPackets && (p = reader.next()) != NULL)
+                    mPackets.push_back(p);
             
-            // readmPackets
-            while (!infile.eof() && infile >> c)
-                switch(c)
-                {
-                    case 'p':// packet descriptions line
-                    {
-                        if (infile >> flowId >> packetId >> arrivalTime >> packetLength)
-                        {
-                            Packet *p = new Packet(flowId,packetId,packetLength,arrivalTime);
-                            mPackets.push_back(p);
-                        }
-                        else throw new std::runtime_error("Missing or wrong packet description.");
-                        std::getline(infile,lines);
-                        break;
-                    }
-                    case 'c':// comments
-                        std::getline(infile,lines);
-                        break;
-                    default:// unknown
-                        throw new std::runtime_error("Unknown declaration.");
-                }
-                
-                if (mPackets.empty())// no packet was found
-                    throw new std::runtime_error("MissingmPackets description.");
-                
+            if (loadPackets && mPackets.empty())// no packet was found
+                throw new std::runtime_error("MissingmPackets description.");
         }
         catch (const std::runtime_error& e)
         {
@@ -145,15 +119,20 @@ public:
             std::cout << "Exception opening/reading file:\n" << "  " << e.what() << std::endl;
         }
         
-        infile.close();
 		mFlowLastDepartVTimes.resize(mFlowWeights.size());
-        PKT_Compare_AT_L pc;
-        std::sort(mPackets.begin(),mPackets.end(),pc);
+        //! stable, so that packets arriving at the same time keep their order in the file
+        SortPacketsByArrival(mPackets,parseThreads);
 
   
         L_GPSsimulator = new L_GPSSim();
 
     }
+    ~L_GPS_Tester()
+    {
+        for (auto pPKT: mPackets)
+            delete pPKT;
+        delete L_GPSsimulator;
+    }
     //! function to show all flows and packets
     void print()
     {
@@ -210,6 +189,275 @@ public:
         ofs.close();
         save2JSON();
     }
+    //! function to simulate every output port as an independent GPS server
+    /*! the ports are sharded over threadNum threads (0 means one thread per 
+        hardware thread), and the results are saved per port in arrival order
+    */
+    void runSharded(unsigned threadNum = 0)
+    {
+        L_GPSShardedSim sharded(mFlowWeights,threadNum);
+        sharded.route(mPackets);
+        sharded.run();
+
+        json jDesp;
+        json jFlow(mFlowWeights);
+        jDesp["flow_weights"].push_back(jFlow);
+        for (auto shard: sharded.GetShards())
+        {
+            json jPort;
+            jPort["portId"] = shard->mPortId;
+            jPort["packets"] = json::array();
+            for (auto pPKT: shard->mPackets)
+                jPort["packets"].push_back(Packet2JSON(pPKT));
+            jDesp["ports"].push_back(jPort);
+        }
+        std::cout << "Saving results of " << sharded.GetShards().size() << " ports to JSON file ...\n";
+        std::ofstream ofs("gps_output.json", std::ofstream::out);
+        ofs << jDesp.dump() << std::endl;
+        ofs.close();
+        std::cout << "Simulation finished!\n";
+    }
+    //! function to save the state of the simulator into a checkpoint file
+    void saveCheckpoint(std::string path)
+    {
+        std::ofstream ofs(path, std::ofstream::out | std::ofstream::binary);
+        L_GPSsimulator->SaveCheckpoint(ofs,mFlowLastDepartVTimes);
+        ofs.close();
+    }
+    //! function to restore the state of the simulator from a checkpoint file
+    /*! the packets arriving after the checkpoint was taken can then be handled
+        without re-simulating from time zero. The checkpoint is loaded into a new 
+        simulator, which replaces the current one only if it is valid.
+    */
+    void loadCheckpoint(std::string path)
+    {
+        std::ifstream ifs(path, std::ifstream::in | std::ifstream::binary);
+        if (!ifs.is_open())
+            throw new std::runtime_error("Cannot open checkpoint file.");
+        L_GPSSim *pSimulator = new L_GPSSim();
+        std::vector<double> flowLastDepartVTimes;
+        try {
+            pSimulator->LoadCheckpoint(ifs,flowLastDepartVTimes);
+            if (flowLastDepartVTimes.size() != mFlowWeights.size())
+                throw new std::runtime_error("Checkpoint does not match the flow configuration.");
+        }
+        catch (...)
+        {
+            delete pSimulator;
+            throw;
+        }
+        delete L_GPSsimulator;
+        L_GPSsimulator = pSimulator;
+        mFlowLastDepartVTimes.swap(flowLastDepartVTimes);
+    }
+    //! function to simulate hierarchical GPS with the class tree given in the file conf
+    /*! the virtual finish time of every packet is in the virtual time of its leaf class
+    */
+    void runHierarchical(std::string conf)
+    {
+        L_HGPSSim hierarchy(mFlowWeights,conf);
+        for (auto pPKT: mPackets)
+            pPKT->mGPS_VFTime = hierarchy.HandleNewPacketArrival(pPKT);
+        save2JSON();
+    }
+    //! function to run parsing, simulation and output as a three-stage pipeline
+    /*! a parser thread streams batches of (at most batchSize) packets from the input
+        file, this thread simulates them, and a writer thread saves the results to the
+        JSON file, the stages are connected by queues holding at most queueBatches
+        batches. Since the packets are never loaded as a whole, they must be sorted by 
+        arrival time in the input file.
+    */
+    void runPipelined(size_t batchSize = 4096,size_t queueBatches = 8)
+    {
+        if (mArePacketsLoaded)
+            throw new std::runtime_error("Pipelined mode requires a tester constructed with loadPackets == false.");
+        typedef std::vector<Packet *>* Batch;
+        BoundedQueue<Batch> parsedQueue(queueBatches);
+        BoundedQueue<Batch> simulatedQueue(queueBatches);
+        std::exception_ptr parserError, writerError;
+
+        //! stage 1: parse the input file
+        std::thread parser([&]{
+            try {
+                TraceReader reader(mInput);
+                long int lastArrivalTime = std::numeric_limits<long int>::min();
+                while (true)
+                {
+                    //! the batch and its packets are freed if parsing or checking it throws
+                    std::unique_ptr<std::vector<Packet *>,void (*)(Batch)> pBatch(new std::vector<Packet *>(),&deleteBatch);
+                    reader.nextBatch(*pBatch,batchSize);
+                    for (auto pPKT: *pBatch)
+                    {
+                        if (pPKT->mArrivalTime < lastArrivalTime)
+                            throw new std::runtime_error("Pipelined mode requires packets sorted by arrival time.");
+                        lastArrivalTime = pPKT->mArrivalTime;
+                    }
+                    if (pBatch->empty() || !parsedQueue.push(pBatch.get()))
+                        break;
+                    //! the batch now belongs to the simulation stage
+                    pBatch.release();
+                }
+            }
+            catch (...) {
+                parserError = std::current_exception();
+            }
+            parsedQueue.close();
+        });
+
+        //! stage 3: save the results (in the same format as save2JSON())
+        std::thread writer([&]{
+            try {
+                std::ofstream ofs("gps_output.json", std::ofstream::out);
+                bool isFirst = true;
+                beginStreamJSON(ofs);
+                Batch pBatch;
+                while (simulatedQueue.pop(pBatch))
+                {
+                    for (auto pPKT: *pBatch)
+                        streamPacket2JSON(ofs,pPKT,isFirst);
+                    deleteBatch(pBatch);
+                }
+                endStreamJSON(ofs);
+            }
+            catch (...) {
+                writerError = std::current_exception();
+            }
+            simulatedQueue.close();
+        });
+
+        //! stage 2: simulate
+        Batch pBatch;
+        while (parsedQueue.pop(pBatch))
+        {
+            for (auto pPKT: *pBatch)
+            {
+                double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+                pPKT->mGPS_VFTime = L_GPSsimulator->HandleNewPacketArrival(pPKT,mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+            }
+            if (!simulatedQueue.push(pBatch))
+            {//! the writer failed, stop the parser as well
+                deleteBatch(pBatch);
+                parsedQueue.close();
+            }
+        }
+        simulatedQueue.close();
+        parser.join();
+        writer.join();
+
+        if (parserError) std::rethrow_exception(parserError);
+        if (writerError) std::rethrow_exception(writerError);
+        std::cout << "Simulation finished!\n";
+    }
+    //! function to simulate a trace which is larger than the memory
+    /*! the packets are streamed from the input file (in any order) into an external
+        merge sort, which uses at most memoryBudget bytes to buffer packets and spills 
+        sorted runs to spillDir, and they are simulated and saved while the runs are
+        merged (at most maxFanIn runs at a time, see ExternalArrivalSorter)
+    */
+    void runExternal(size_t memoryBudget,std::string spillDir = ".",size_t maxFanIn = 64)
+    {
+        if (mArePacketsLoaded)
+            throw new std::runtime_error("External mode requires a tester constructed with loadPackets == false.");
+        ExternalArrivalSorter sorter(memoryBudget,spillDir,1,maxFanIn);
+        {
+            TraceReader reader(mInput);
+            Packet *pPKT;
+            while ((pPKT = reader.next()) != NULL)
+                sorter.add(pPKT);
+        }
+        sorter.finish();
+        std::cout << "Sorted packets in " << sorter.GetRunNum() << " runs and " << sorter.GetMergePassNum() << " intermediate merge passes.\n";
+
+        std::ofstream ofs("gps_output.json", std::ofstream::out);
+        bool isFirst = true;
+        beginStreamJSON(ofs);
+        Packet *pPKT;
+        while ((pPKT = sorter.next()) != NULL)
+        {
+            double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+            pPKT->mGPS_VFTime = L_GPSsimulator->HandleNewPacketArrival(pPKT,mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+            streamPacket2JSON(ofs,pPKT,isFirst);
+            delete pPKT;
+        }
+        endStreamJSON(ofs);
+        std::cout << "Simulation finished!\n";
+    }
+    //! function to simulate the departures of the packets under fluid GPS
+    /*! the results are saved in order of departure, with the real finish time of every
+        packet in addition to its virtual finish time
+    */
+    void runDepartures()
+    {
+        L_GPSDepartureEngine engine(mFlowWeights);
+        std::vector<Packet *> departures;
+        std::ofstream ofs("gps_output.json", std::ofstream::out);
+        bool isFirst = true;
+        beginStreamJSON(ofs);
+        for (auto pPKT: mPackets)
+        {
+            departures.clear();
+            engine.HandleNewPacketArrival(pPKT,departures);
+            for (auto pDeparted: departures)
+                streamDeparture2JSON(ofs,pDeparted,isFirst);
+        }
+        departures.clear();
+        engine.Finish(departures);
+        for (auto pDeparted: departures)
+            streamDeparture2JSON(ofs,pDeparted,isFirst);
+        endStreamJSON(ofs);
+        std::cout << "Simulation finished!\n";
+    }
+    //! function to simulate a network of GPS links with the topology given in the file conf
+    /*! the packets of the trace arrive at the first link of the route of their flow, and
+        every crossing of a link is saved (in order of departure from the link) with its
+        arrival and departure times
+    */
+    void runNetwork(std::string conf)
+    {
+        L_GPSNetworkSim network(mFlowWeights,conf);
+        std::vector<HopRecord> records;
+        json jFlows;
+        jFlows.push_back(json(mFlowWeights));
+        std::ofstream ofs("gps_output.json", std::ofstream::out);
+        ofs << "{\"flow_weights\":" << jFlows.dump() << ",\"hops\":[";
+        bool isFirst = true;
+        for (size_t i = 0;i <= mPackets.size();++ i)
+        {
+            records.clear();
+            if (i < mPackets.size())
+                network.HandleNewPacketArrival(mPackets[i],records);
+            else
+                network.Finish(records);
+            for (auto& record: records)
+            {
+                if (!isFirst) ofs << ",";
+                isFirst = false;
+                json j = {
+                    {"flowId",record.mpPacket->mFlowId},
+                    {"packetId",record.mpPacket->mPacketId},
+                    {"linkId",record.mLinkId},
+                    {"hop",record.mHop},
+                    {"arrivalTime",record.mArrivalTime},
+                    {"departureTime",record.mDepartureTime},
+                    {"delay",record.mDepartureTime - record.mArrivalTime}
+                };
+                ofs << j.dump();
+            }
+        }
+        ofs << "]}" << std::endl;
+        ofs.close();
+        for (auto& l: network.GetLinks())
+        {
+            NetworkLink *pLink = l.second;
+            std::cout << "link " << pLink->mLinkId
+                      << ": packets " << pLink->mPacketNum
+                      << ", mean delay " << (pLink->mPacketNum != 0 ? pLink->mSumDelay / pLink->mPacketNum : 0.0)
+                      << ", max delay " << pLink->mMaxDelay
+                      << std::endl;
+        }
+        std::cout << "Simulated " << network.GetEventNum() << " events.\n";
+        std::cout << "Simulation finished!\n";
+    }
     void save2JSON()
     {
         json jDesp;
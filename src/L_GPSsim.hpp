@@ -34,10 +34,20 @@
 #ifndef L_GPS_HPP
 #define L_GPS_HPP
 
-#define AUGMENTED_L_GPS
+#include <cmath> // for fabs
+#include <cstring> // for memcmp, memcpy
+#include <cstdint> // for uint64_t
+#include <iostream> // for istream, ostream
+#include <iterator> // for istreambuf_iterator
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread> // for yield
+#include <stdexcept> // for runtime_error
 
 #include "avlTree.hpp"
 #include "packet.hpp"
+#include "L_GPS_Lockstep.hpp"
 
 //! class for data of the node in AVL tree
 class DataField{
@@ -66,7 +76,152 @@ class Compare_VTM_L { // simple comparison function
       bool operator()(const DataField& d1,const DataField& d2) { return d1.mVTimeMax < d2.mVTimeMax; } 
 };
 
+//! aggregation policy of the AVL tree of break points
+/*! the break points are kept in the leaves, and every internal node keeps, for its subtree,
+	the maximum virtual time, the sum of the weight changes and the real time offset 
+	mDeltaRTime used by RTime2VTime()
+*/
+struct L_GPSAugmentation{
+	static const bool IS_LEAF_ORIENTED = true;
+	static inline bool combine(DataField& parent,const DataField& left,const DataField& right)
+	{
+		double VTimeMax = right.mVTimeMax;
+		double deltaWeight = left.mDeltaWeight + right.mDeltaWeight;
+		double deltaRTime = left.mDeltaRTime + right.mDeltaRTime - (right.mVTimeMax - left.mVTimeMax) * left.mDeltaWeight;
+		bool isChanged = VTimeMax != parent.mVTimeMax || deltaWeight != parent.mDeltaWeight || deltaRTime != parent.mDeltaRTime;
+		parent.mVTimeMax = VTimeMax;
+		parent.mDeltaWeight = deltaWeight;
+		parent.mDeltaRTime = deltaRTime;
+		return isChanged;
+	}
+	//! break points at the same virtual time are merged into one
+	static inline void merge(DataField& leaf,const DataField& data)
+	{
+		leaf.mDeltaWeight += data.mDeltaWeight;
+	}
+	//! a break point whose weight changes cancel out does not change the virtual time
+	static inline bool isVoid(const DataField& leaf)
+	{
+		return std::fabs(leaf.mDeltaWeight) <= 1e-8;
+	}
+};
+
+//! AVL tree of break points of L_GPSSim, whose links are published to the concurrent readers (see L_GPSSimReader)
+typedef AVL_Tree<DataField,Compare_VTM_L,L_GPSAugmentation,PublishedLinks> BreakPointTree;
+//! node of BreakPointTree
+typedef node<DataField,PublishedLinks> BreakPointTreeNode;
+
+//! header of a binary checkpoint of L_GPSSim
+/*! a checkpoint is laid out as
+	CheckpointHeader
+	CheckpointBreakPoint[mBreakPointNum] (sorted by virtual time)
+	double[mFlowNum] (virtual finish time of the last packet of each flow)
+	all the fields are 8 bytes (in host byte order), so the file can be mapped into
+	memory and read in place by L_GPSSim::LoadCheckpoint(const char*,size_t,...)
+*/
+struct CheckpointHeader{
+	char mMagic[8];
+	uint64_t mVersion;
+	double mOldVTime;
+	double mOldRTime;
+	double mSumWeight;
+	uint64_t mBreakPointNum;
+	uint64_t mFlowNum;
+};
+//! break point as stored in a checkpoint
+struct CheckpointBreakPoint{
+	double mVTime;
+	double mDeltaWeight;
+};
+
+//! hint to load the node at address p into the cache
+#if defined(__GNUC__)
+#define LGPS_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define LGPS_PREFETCH(p)
+#endif
+
+//! brackets of the reads of a seqlock reader, which race with the updates by design
+/*! a read is retried if an update ran meanwhile, so ThreadSanitizer is told to ignore the
+	plain reads in between (the sequence number, the epochs and the links of the tree are 
+	atomic, so they are still checked and still order the reads)
+*/
+#if defined(__SANITIZE_THREAD__)
+#define LGPS_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define LGPS_TSAN
+#endif
+#endif
+#ifdef LGPS_TSAN
+extern "C" void AnnotateIgnoreReadsBegin(const char* file,int line);
+extern "C" void AnnotateIgnoreReadsEnd(const char* file,int line);
+#define LGPS_RACY_READS_BEGIN() AnnotateIgnoreReadsBegin(__FILE__,__LINE__)
+#define LGPS_RACY_READS_END() AnnotateIgnoreReadsEnd(__FILE__,__LINE__)
+#else
+#define LGPS_RACY_READS_BEGIN()
+#define LGPS_RACY_READS_END()
+#endif
+
+//! state shared by L_GPSSim and its concurrent readers (see L_GPSSim::EnableConcurrentReaders())
+struct L_GPSReadSide{
+	//! maximum number of readers at the same time
+	static const int MAX_READERS = 64;
+	//! sequence number of the seqlock, odd while the simulator is updated
+	std::atomic<uint64_t> mSequence;
+	//! global epoch, and the epoch announced by every reader slot (0 if the slot is not reading)
+	std::atomic<uint64_t> mEpoch;
+	std::atomic<uint64_t> mReaderEpochs[MAX_READERS];
+	std::atomic<bool> mIsSlotUsed[MAX_READERS];
+	//! nodes removed from the tree by the current update
+	std::vector<BreakPointTreeNode*> mRetiring;
+	//! nodes removed by the past updates, along with the epoch at which they were retired
+	std::deque<std::pair<uint64_t,std::vector<BreakPointTreeNode*> > > mRetired;
+	L_GPSReadSide()
+	{
+		mSequence = 0;
+		mEpoch = 1;
+		for (int i = 0;i < MAX_READERS;++ i)
+		{
+			mReaderEpochs[i] = 0;
+			mIsSlotUsed[i] = false;
+		}
+	}
+	~L_GPSReadSide()
+	{
+		for (auto& batch: mRetired)
+			for (auto pNode: batch.second)
+				delete pNode;
+		for (auto pNode: mRetiring)
+			delete pNode;
+	}
+	//! function to free the nodes retired before the epoch of every active reader
+	void Reclaim()
+	{
+		if (!mRetiring.empty())
+		{
+			mRetired.push_back(std::make_pair(mEpoch.fetch_add(1),std::vector<BreakPointTreeNode*>()));
+			mRetired.back().second.swap(mRetiring);
+		}
+		if (mRetired.empty()) return;
+		uint64_t minEpoch = mEpoch.load();
+		for (int i = 0;i < MAX_READERS;++ i)
+		{
+			uint64_t epoch = mReaderEpochs[i].load();
+			if (epoch != 0 && epoch < minEpoch)
+				minEpoch = epoch;
+		}
+		while (!mRetired.empty() && mRetired.front().first < minEpoch)
+		{
+			for (auto pNode: mRetired.front().second)
+				delete pNode;
+			mRetired.pop_front();
+		}
+	}
+};
+
 class L_GPSSim{
+	friend class L_GPSSimReader;
 	//! old value for virtual time 
 	double mOldVTime;
 	//! old value for real time 
@@ -82,16 +237,62 @@ class L_GPSSim{
 	/*! the balanced tree stores all the break points and expected
 	break points after time mOldRTime
 	*/
-	AVL_Tree<DataField, Compare_VTM_L> *mpBalancedTree;
+	BreakPointTree *mpBalancedTree;
+	//! state shared with the concurrent readers (NULL if they are not enabled)
+	L_GPSReadSide *mpReadSide;
+	//! function to start an update of the state seen by the concurrent readers
+	void BeginWrite()
+	{
+		if (mpReadSide == NULL) return;
+		mpReadSide->mSequence.store(mpReadSide->mSequence.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	//! function to end an update of the state seen by the concurrent readers, and to free the nodes no reader can hold
+	void EndWrite()
+	{
+		if (mpReadSide == NULL) return;
+		mpReadSide->mSequence.store(mpReadSide->mSequence.load(std::memory_order_relaxed) + 1,std::memory_order_release);
+		mpReadSide->Reclaim();
+	}
 public:
 	//! constructor
 	L_GPSSim()
 	{
-		mOldRTime = 0;
+		mOldVTime = 0;
 		mOldRTime = 0;
 		mSumWeight = 0;
 
-		mpBalancedTree = new AVL_Tree<DataField, Compare_VTM_L>();
+		mpBalancedTree = new BreakPointTree();
+		mpReadSide = NULL;
+	}
+	//! destructor, no concurrent reader may be active
+	~L_GPSSim()
+	{
+		DisableConcurrentReaders();
+		mpBalancedTree->clear();
+		delete mpBalancedTree;
+	}
+	//! function to allow other threads to read the state through L_GPSSimReader while the simulator runs
+	/*! the updates made by HandleNewPacketArrival(), HandleNewArrival(), ExpireBreakPoints()
+		and LoadCheckpoint() are then protected by a seqlock, and the nodes they remove from 
+		the tree are retired rather than freed, until no reader can hold them any more 
+		(epoch-based reclamation), so the readers never block the simulator: they retry
+		if an update ran during their read. The other functions modifying the state must not
+		be called while readers are active.
+	*/
+	void EnableConcurrentReaders()
+	{
+		if (mpReadSide != NULL) return;
+		mpReadSide = new L_GPSReadSide();
+		mpBalancedTree->setRetiredNodes(&mpReadSide->mRetiring);
+	}
+	//! function to stop the concurrent reads, no reader may be active
+	void DisableConcurrentReaders()
+	{
+		if (mpReadSide == NULL) return;
+		mpBalancedTree->setRetiredNodes(NULL);
+		delete mpReadSide;
+		mpReadSide = NULL;
 	}
 	//! function to handle the event of packet arrival 
 	/*! note that upon each packet arrival event, there are at most two updates
@@ -112,30 +313,79 @@ public:
             packet: real time (arrival time), packet length (in terms of bytes),
             and weight of the flow this packet belongs to
         */
-		double newRTime = pPKT->mArrivalTime;
-		double packetLength = pPKT->mLength;
+		return HandleNewArrival(pPKT->mArrivalTime,pPKT->mLength,flowWeight,flowLastDepartVTime);
+	}
+	//! function to handle the arrival of packetLength units of work at real time newRTime
+	/*! the same as HandleNewPacketArrival(), but the real time does not need to be an integer
+	    (e.g., when it is the amount of service received by a class in hierarchical GPS).
+	    If pCurVTime is not NULL, it receives the virtual time at newRTime.
+	*/
+	double HandleNewArrival(double newRTime,double packetLength,double flowWeight,double& flowLastDepartVTime,double* pCurVTime = NULL)
+	{
 		//double eps = 1e-8;
 
+		BeginWrite();
+		//! restart the virtual clock if the server has been idle
+		RestartIfIdle(newRTime);
+
 		/*! calculate the virtual start time and virtual finish time of this
 			packet (details you can refer to the description of the function
-			RTime2VTime())
+			RTime2VTimeFinger())
 		*/
-		double curVTime = RTime2VTime(newRTime);
+		double curVTime = RTime2VTimeFinger(newRTime);
+		if (pCurVTime != NULL)
+			*pCurVTime = curVTime;
 		double newVTime = curVTime;
 		if (newVTime < flowLastDepartVTime)
 			newVTime = flowLastDepartVTime;
 		double newExpectedBreakPoint = newVTime + packetLength / flowWeight;
 		flowLastDepartVTime = newExpectedBreakPoint;
-		//! insert the "break point" corresponding to the arrival of this packet
-		//if (! mpBalancedTree->empty() && abs(newVTime) > eps)
-		Append(curVTime,newVTime,flowWeight);
-		/*! insert the expected break point corresponding to the departure of this 
-		    packet
+		/*! if the flow is backlogged, the arrival of this packet cancels the expected 
+			break point of the previous packet, so the flow keeps one break point in the 
+			tree (at most one per backlogged flow), which moves to the finish time of this
+			packet; otherwise insert the "break point" corresponding to the arrival of this 
+			packet and the expected break point corresponding to its departure
 		*/
-		Append(curVTime,newExpectedBreakPoint,-flowWeight);
+		if (newVTime > curVTime)
+			MoveExpectedBreakPoint(curVTime,newVTime,newExpectedBreakPoint,flowWeight);
+		else
+		{
+			Append(curVTime,newVTime,flowWeight);
+			Append(curVTime,newExpectedBreakPoint,-flowWeight);
+		}
+		EndWrite();
 
 		return newExpectedBreakPoint;
 	}
+	//! function to restart the virtual clock if the server is idle at time newRTime
+	/*! once the real time passes the last (expected) break point, the total weight 
+		is zero and the virtual time stops. As the break points cannot describe real 
+		time passing at a constant virtual time, they are all dropped, and the state 
+		is re-anchored at (virtual time of the last break point, newRTime).
+	*/
+	void RestartIfIdle(double newRTime)
+	{
+		double eps = 1e-8;
+		BreakPointTreeNode *pRoot = mpBalancedTree->GetRoot();
+		if (pRoot == NULL)
+		{
+			if (std::fabs(mSumWeight) <= eps)
+			{
+				mOldRTime = newRTime;
+				mSumWeight = 0;
+			}
+			return;
+		}
+		//! the root aggregates all the break points
+		if (std::fabs(mSumWeight + pRoot->data.mDeltaWeight) > eps) return;
+		double lastRTime = mOldRTime + (pRoot->data.mVTimeMax - mOldVTime) * mSumWeight - pRoot->data.mDeltaRTime;
+		if (newRTime < lastRTime) return;
+
+		mOldVTime = pRoot->data.mVTimeMax;
+		mOldRTime = newRTime;
+		mSumWeight = 0;
+		mpBalancedTree->clear();
+	}
 	//! Function to compute the corresponding virtual time for a new real time
 	/*!
 		this function performs a binary search for the NewRTime on all the break points
@@ -155,8 +405,8 @@ public:
 		double eps = 1e-8;
 
 	    //! obtain the root of the AVL tree
-		node<DataField> *pCurNode = mpBalancedTree->GetRoot();
-		if (pCurNode != NULL && abs(oldSumWeight) > eps)
+		BreakPointTreeNode *pCurNode = mpBalancedTree->GetRoot();
+		if (pCurNode != NULL && std::fabs(oldSumWeight) > eps)
 		{
 			//! perform search on the tree
 			while (!mpBalancedTree->IsLeaf(pCurNode))
@@ -177,8 +427,198 @@ public:
 			}
 			return oldVTime + (NewRTime - oldRTime) / oldSumWeight;
 		}
-
-			return 0.0;	
+		//! the virtual time does not move while the server is idle
+		return oldVTime;
+	}
+	//! Function to compute the corresponding virtual time for a new real time without branches on the path
+	/*! the same as RTime2VTime(), but the choice between the children and the updates of
+		the state are done by indexed loads instead of a data-dependent branch (which is
+		mispredicted about half of the time on random queries), and both children are 
+		prefetched before the comparison, so that the next node is loaded while the current 
+		one is processed. The result is bit-identical to RTime2VTime().
+	*/
+	double RTime2VTimeBranchless(double NewRTime)
+	{
+		double eps = 1e-8;
+		double oldVTime = mOldVTime,
+			   oldRTime = mOldRTime,
+			   oldSumWeight = mSumWeight;
+		BreakPointTreeNode *pCurNode = mpBalancedTree->GetRoot();
+		if (pCurNode == NULL || std::fabs(oldSumWeight) <= eps)
+			return oldVTime;
+		//! internal nodes always have two children
+		while (pCurNode->left != NULL)
+		{
+			BreakPointTreeNode *children[2] = {pCurNode->left,pCurNode->right};
+			LGPS_PREFETCH(children[1]);
+			LGPS_PREFETCH(children[0]->left);
+			LGPS_PREFETCH(children[0]->right);
+			const DataField& left = children[0]->data;
+			double RTimeLMax = oldRTime + (left.mVTimeMax - oldVTime) * oldSumWeight - left.mDeltaRTime;
+			//! 0 to locate in the left subtree, 1 to locate in the right subtree
+			int isRight = !(NewRTime < RTimeLMax);
+			double sumWeights[2] = {oldSumWeight,oldSumWeight + left.mDeltaWeight};
+			double VTimes[2] = {oldVTime,left.mVTimeMax};
+			double RTimes[2] = {oldRTime,RTimeLMax};
+			oldSumWeight = sumWeights[isRight];
+			oldVTime = VTimes[isRight];
+			oldRTime = RTimes[isRight];
+			pCurNode = children[isRight];
+		}
+		return oldVTime + (NewRTime - oldRTime) / oldSumWeight;
+	}
+	//! Function to compute the virtual times for n independent real times times[0..n-1] (in any order)
+	/*! out[i] receives the virtual time at times[i] (as computed by RTime2VTime()). The
+		tree is descended for several real times in lockstep with SIMD instructions (see 
+		L_GPS_Lockstep.hpp), using the widest kernel up to maxISA supported by the CPU.
+		The state of the simulator is not modified.
+	*/
+	void RTime2VTimeLockstep(const double* times,size_t n,double* out,LockstepISA maxISA = LOCKSTEP_AVX2)
+	{
+		double eps = 1e-8;
+		BreakPointTreeNode *pRoot = mpBalancedTree->GetRoot();
+		if (pRoot == NULL || std::fabs(mSumWeight) <= eps)
+		{//! the virtual time does not move while the server is idle
+			for (size_t i = 0;i < n;++ i)
+				out[i] = mOldVTime;
+			return;
+		}
+		LockstepDescent<BreakPointTreeNode>::descend(pRoot,mOldVTime,mOldRTime,mSumWeight,times,n,out,maxISA);
+	}
+	//! Function to compute the virtual times for n real times sortedTimes[0..n-1] in non-decreasing order
+	/*! out[i] receives the virtual time at sortedTimes[i], bit-identical to RTime2VTime().
+		Instead of one search per real time, the descents of RTime2VTime() are replayed
+		one after the other on a single in-order walk of the tree: the nodes where the
+		current descent went left are kept on a stack with their state, and the next
+		query resumes at the highest of them where it goes right, which is found from 
+		the smallest real time of a left turn on the path to every node of the stack. 
+		Every node is pushed and popped at most once, hence the cost is O(n + m) for m 
+		break points (only the break points up to the last query are visited). The 
+		state of the simulator is not modified.
+	*/
+	void RTime2VTime(const double* sortedTimes,size_t n,double* out)
+	{
+		double eps = 1e-8;
+		if (mpBalancedTree->empty() || std::fabs(mSumWeight) <= eps)
+		{//! the virtual time does not move while the server is idle
+			for (size_t i = 0;i < n;++ i)
+				out[i] = mOldVTime;
+			return;
+		}
+		//! node where the descent went left, its state, the real time at the end of its left subtree and the smallest one down to it
+		struct LeftTurn{
+			BreakPointTreeNode *pNode;
+			double VTime, RTime, sumWeight, RTimeLMax, minRTimeLMax;
+		};
+		std::vector<LeftTurn> stack;
+		double oldVTime = mOldVTime,
+			   oldRTime = mOldRTime,
+			   oldSumWeight = mSumWeight;
+		BreakPointTreeNode *pCurNode = mpBalancedTree->GetRoot();
+		//! function to go left from pCurNode down to a leaf
+		auto descendLeft = [&](){
+			for (;!mpBalancedTree->IsLeaf(pCurNode);pCurNode = pCurNode->left)
+			{
+				LeftTurn turn;
+				turn.pNode = pCurNode;
+				turn.VTime = oldVTime;
+				turn.RTime = oldRTime;
+				turn.sumWeight = oldSumWeight;
+				turn.RTimeLMax = oldRTime + (pCurNode->left->data.mVTimeMax - oldVTime) * oldSumWeight - pCurNode->left->data.mDeltaRTime;
+				turn.minRTimeLMax = stack.empty() ? turn.RTimeLMax : std::min(stack.back().minRTimeLMax,turn.RTimeLMax);
+				stack.push_back(turn);
+			}
+		};
+		descendLeft();
+		for (size_t i = 0;i < n;++ i)
+		{
+			while (!stack.empty() && !(sortedTimes[i] < stack.back().minRTimeLMax))
+			{
+				//! the first node of the path where the descent of sortedTimes[i] goes right
+				while (stack.size() > 1 && !(sortedTimes[i] < stack[stack.size() - 2].minRTimeLMax))
+					stack.pop_back();
+				LeftTurn turn = stack.back();
+				stack.pop_back();
+				oldSumWeight = turn.sumWeight + turn.pNode->left->data.mDeltaWeight;
+				oldVTime = turn.pNode->left->data.mVTimeMax;
+				oldRTime = turn.RTimeLMax;
+				pCurNode = turn.pNode->right;
+				descendLeft();
+			}
+			out[i] = oldVTime + (sortedTimes[i] - oldRTime) / oldSumWeight;
+		}
+	}
+	//! Function to compute the corresponding virtual time for a new real time by a finger search
+	/*! the same as RTime2VTime(), but the search starts from the leftmost leaf: it climbs 
+		the left spine of the tree up to the first node whose subtree ends after NewRTime 
+		(every subtree on the spine starts at the leftmost break point, hence the real time
+		at its end follows from the current state and its augmented members), and descends 
+		from there. As real time moves forward, the cost is O(log d), where d is the number
+		of break points crossed since the last event, instead of O(log n).
+	*/
+	double RTime2VTimeFinger(double NewRTime)
+	{
+		double eps = 1e-8;
+		const std::vector<BreakPointTreeNode*>& spine = mpBalancedTree->getLeftSpine();
+		if (spine.empty() || std::fabs(mSumWeight) <= eps)
+			return mOldVTime;
+		size_t level = spine.size() - 1;
+		while (level > 0)
+		{
+			DataField& data = spine[level]->data;
+			double RTimeMax = mOldRTime + (data.mVTimeMax - mOldVTime) * mSumWeight - data.mDeltaRTime;
+			if (NewRTime < RTimeMax) break;
+			-- level;
+		}
+		//! the descent from the root would go left down to spine[level]
+		double oldVTime = mOldVTime,
+			   oldRTime = mOldRTime,
+			   oldSumWeight = mSumWeight;
+		BreakPointTreeNode *pCurNode = spine[level];
+		while (!mpBalancedTree->IsLeaf(pCurNode))
+		{
+			double RTimeLMax = oldRTime + (pCurNode->left->data.mVTimeMax - oldVTime) * oldSumWeight - pCurNode->left->data.mDeltaRTime;
+			if (NewRTime < RTimeLMax) //! locate in left subtree
+				pCurNode = pCurNode->left;
+			else//! locate in the right subtree
+			{
+				oldSumWeight += pCurNode->left->data.mDeltaWeight;
+				oldVTime = pCurNode->left->data.mVTimeMax;
+				oldRTime = RTimeLMax;
+				pCurNode = pCurNode->right;
+			}
+		}
+		return oldVTime + (NewRTime - oldRTime) / oldSumWeight;
+	}
+	//! Function to compute the real time at which the virtual time reaches VTime, the inverse of RTime2VTime()
+	/*! VTime must be no earlier than mOldVTime and no later than the last break point
+		(e.g., the virtual finish time of a packet in the system). The descent is the one of
+		RTime2VTime(), but it is guided by the virtual times, which are the keys of the tree.
+		The result is final once the virtual time has passed VTime, since the break points
+		inserted afterwards are all later.
+	*/
+	double VTime2RTime(double VTime)
+	{
+		double oldVTime = mOldVTime,
+			   oldRTime = mOldRTime,
+			   oldSumWeight = mSumWeight;
+		BreakPointTreeNode *pCurNode = mpBalancedTree->GetRoot();
+		if (pCurNode == NULL)
+			return oldRTime;
+		while (!mpBalancedTree->IsLeaf(pCurNode))
+		{
+			const DataField& left = pCurNode->left->data;
+			if (VTime <= left.mVTimeMax) //! locate in left subtree
+				pCurNode = pCurNode->left;
+			else//! locate in the right subtree
+			{
+				oldRTime += (left.mVTimeMax - oldVTime) * oldSumWeight - left.mDeltaRTime;
+				oldSumWeight += left.mDeltaWeight;
+				oldVTime = left.mVTimeMax;
+				pCurNode = pCurNode->right;
+			}
+		}
+		return oldRTime + (VTime - oldVTime) * oldSumWeight;
 	}
 	//! function to insert a node (i.e., a break point or an expected break point)
 	/*! this function insert a new node into the AVL tree, and it calls the function
@@ -200,10 +640,30 @@ public:
 		//! perform removal when necessary
 		RemoveBreakPointIfNecessary(curVTime);
 	}
-	//! function to remove the leftmost leaf in the tree when necessary
-	/*! this function removes the leftmost leaf in the AVL tree when its mVTimeMax is no 
-		greater than the current virtual time (i.e., curVTime) and it will update the 
-		members: mOldRTime, mOldVTime, and mSumWeight.
+	//! function to move the expected break point of a backlogged flow of weight flowWeight from oldVTime to newVTime
+	/*! the arrival cancels the weight change of the flow in the break point at oldVTime
+		(which is removed if no other flow shares it) and a new expected break point is 
+		appended. If it cannot be found (e.g., the caller keeps the finish times itself), 
+		both break points are appended as usual.
+		Updating the key of the break point in place (AVL_Tree::updateKey()) needs a 
+		findLeaf() first to know whether the leaf is shared, and was not faster: about 
+		300 ns per packet either way on benchIndexes -r, with 213 break points at most,
+		against 272 if both break points are appended.
+	*/
+	void MoveExpectedBreakPoint(double curVTime,double oldVTime,double newVTime,double flowWeight)
+	{
+		DataField data(oldVTime,flowWeight);
+		if (!mpBalancedTree->mergeIntoLeaf(data))
+			Append(curVTime,oldVTime,flowWeight);
+		Append(curVTime,newVTime,-flowWeight);
+	}
+	//! function to remove the leftmost leaves in the tree when necessary
+	/*! this function removes the leftmost leaf in the AVL tree as long as its mVTimeMax is
+		no greater than the current virtual time (i.e., curVTime) and it will update the 
+		members: mOldRTime, mOldVTime, and mSumWeight. All the passed break points must go:
+		one left behind (e.g., the arrival break point of a flow at curVTime, ordered after
+		the passed break point of another flow at the same virtual time) makes the total
+		weight zero while flows are backlogged, which stops the virtual clock.
 
 		1. note that, the removal procedure is slightly different from the standard removal 
 		operation of the binary search tree, if will replace the parent of the removed 
@@ -215,20 +675,239 @@ public:
 	{
 		//! create the data field 
 		DataField data(curVTime,0);
-		//! remove the leftmost leaf when necessary
-		if (mpBalancedTree->removeLeftmostLeafIfNecessary(data))
+		//! remove the leftmost leaf when necessary (data receives the removed leaf)
+		while (mpBalancedTree->removeLeftmostLeafIfNecessary(data))
 		{
 			//! update all the member variables
 			mOldRTime += mSumWeight * (data.mVTimeMax - mOldVTime); //! TODO: check its correctness
 			mOldVTime = data.mVTimeMax;
 			mSumWeight += data.mDeltaWeight;
+			data = DataField(curVTime,0);
+		}
+	}
+	//! function to remove at once all the break points no greater than curVTime
+	/*! the passed break points are split off the tree, and the state is moved past all
+		of them using their aggregate, instead of removing them one by one. Returns the 
+		number of removed break points.
+	*/
+	size_t ExpireBreakPoints(double curVTime)
+	{
+		DataField data(curVTime,0), removed;
+		BeginWrite();
+		size_t count = mpBalancedTree->removeLeavesNotAfter(data,&removed);
+		if (count != 0)
+		{
+			mOldRTime += mSumWeight * (removed.mVTimeMax - mOldVTime) - removed.mDeltaRTime;
+			mOldVTime = removed.mVTimeMax;
+			mSumWeight += removed.mDeltaWeight;
+		}
+		EndWrite();
+		return count;
+	}
+	//! function to save the state of the simulator into a binary checkpoint
+	/*! flowLastDepartVTimes are the virtual finish times of the last packets of 
+		the flows, which are kept by the caller of HandleNewPacketArrival()
+	*/
+	void SaveCheckpoint(std::ostream& os,const std::vector<double>& flowLastDepartVTimes)
+	{
+		std::vector<DataField> leaves;
+		mpBalancedTree->getLeaves(leaves);
+
+		CheckpointHeader header;
+		std::memcpy(header.mMagic,"LGPSCKPT",8);
+		header.mVersion = 1;
+		header.mOldVTime = mOldVTime;
+		header.mOldRTime = mOldRTime;
+		header.mSumWeight = mSumWeight;
+		header.mBreakPointNum = leaves.size();
+		header.mFlowNum = flowLastDepartVTimes.size();
+		os.write((const char *)&header,sizeof(header));
+
+		std::vector<CheckpointBreakPoint> breakPoints(leaves.size());
+		for (size_t i = 0;i < leaves.size();++ i)
+		{
+			breakPoints[i].mVTime = leaves[i].mVTimeMax;
+			breakPoints[i].mDeltaWeight = leaves[i].mDeltaWeight;
+		}
+		os.write((const char *)breakPoints.data(),breakPoints.size() * sizeof(CheckpointBreakPoint));
+		os.write((const char *)flowLastDepartVTimes.data(),flowLastDepartVTimes.size() * sizeof(double));
+		if (!os.good())
+			throw new std::runtime_error("Cannot write checkpoint.");
+	}
+	//! function to restore the state of the simulator from a binary checkpoint stream
+	void LoadCheckpoint(std::istream& is,std::vector<double>& flowLastDepartVTimes)
+	{
+		std::vector<char> buffer((std::istreambuf_iterator<char>(is)),std::istreambuf_iterator<char>());
+		LoadCheckpoint(buffer.data(),buffer.size(),flowLastDepartVTimes);
+	}
+	//! function to restore the state of the simulator from a checkpoint in memory (e.g., a mapped file)
+	/*! the tree is built bottom-up from the sorted break points in O(n). The checkpoint
+		is validated before the state is changed, so the simulator and flowLastDepartVTimes
+		are left untouched if it throws.
+	*/
+	void LoadCheckpoint(const char* pData,size_t size,std::vector<double>& flowLastDepartVTimes)
+	{
+		CheckpointHeader header;
+		if (size < sizeof(header))
+			throw new std::runtime_error("Truncated checkpoint.");
+		std::memcpy(&header,pData,sizeof(header));
+		if (std::memcmp(header.mMagic,"LGPSCKPT",8) != 0 || header.mVersion != 1)
+			throw new std::runtime_error("Unknown checkpoint format.");
+		//! the counts are checked one by one, so that their products cannot overflow
+		size_t payload = size - sizeof(header);
+		if (header.mBreakPointNum > payload / sizeof(CheckpointBreakPoint))
+			throw new std::runtime_error("Truncated checkpoint.");
+		payload -= header.mBreakPointNum * sizeof(CheckpointBreakPoint);
+		if (header.mFlowNum > payload / sizeof(double) || payload != header.mFlowNum * sizeof(double))
+			throw new std::runtime_error("Truncated checkpoint.");
+
+		const char *pBreakPoints = pData + sizeof(header);
+		std::vector<DataField> leaves(header.mBreakPointNum);
+		for (size_t i = 0;i < leaves.size();++ i)
+		{
+			CheckpointBreakPoint breakPoint;
+			std::memcpy(&breakPoint,pBreakPoints + i * sizeof(breakPoint),sizeof(breakPoint));
+			//! the tree is built as is, so the keys must be strictly increasing (which also rejects NaN)
+			if (i > 0 && !(leaves[i - 1].mVTimeMax < breakPoint.mVTime))
+				throw new std::runtime_error("Break points of checkpoint are not sorted.");
+			leaves[i] = DataField(breakPoint.mVTime,breakPoint.mDeltaWeight);
 		}
+		const char *pFlows = pBreakPoints + header.mBreakPointNum * sizeof(CheckpointBreakPoint);
+		flowLastDepartVTimes.resize(header.mFlowNum);
+		std::memcpy(flowLastDepartVTimes.data(),pFlows,header.mFlowNum * sizeof(double));
+
+		BeginWrite();
+		mOldVTime = header.mOldVTime;
+		mOldRTime = header.mOldRTime;
+		mSumWeight = header.mSumWeight;
+		mpBalancedTree->buildFromSortedLeaves(leaves.data(),leaves.size());
+		EndWrite();
 	}
-	AVL_Tree<DataField,Compare_VTM_L>* GetAVLTree()
+	BreakPointTree* GetAVLTree()
 	{
 		return mpBalancedTree;
 	}
 
 };
 
+//! class for a reader of the state of an L_GPSSim from another thread, to be used by one thread
+/*! the simulator must have called EnableConcurrentReaders(), and the reader takes one of
+	the L_GPSReadSide::MAX_READERS slots for its lifetime. Every read returns a consistent
+	state, i.e., the one after some event, without ever blocking the simulator.
+*/
+class L_GPSSimReader{
+	L_GPSSim& mSim;
+	L_GPSReadSide& mReadSide;
+	int mSlot;
+	static L_GPSReadSide& GetReadSide(L_GPSSim& sim)
+	{
+		if (sim.mpReadSide == NULL)
+			throw new std::runtime_error("Concurrent readers are not enabled.");
+		return *sim.mpReadSide;
+	}
+	//! function to start a read, returns the sequence number of the state it sees
+	uint64_t BeginRead()
+	{
+		uint64_t sequence;
+		while ((sequence = mReadSide.mSequence.load(std::memory_order_acquire)) & 1)
+			std::this_thread::yield();
+		LGPS_RACY_READS_BEGIN();
+		return sequence;
+	}
+	//! function to tell whether the state changed since BeginRead() returned sequence
+	bool IsChanged(uint64_t sequence)
+	{
+		LGPS_RACY_READS_END();
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return mReadSide.mSequence.load(std::memory_order_relaxed) != sequence;
+	}
+public:
+	explicit L_GPSSimReader(L_GPSSim& sim):mSim(sim),mReadSide(GetReadSide(sim))
+	{
+		for (mSlot = 0;mSlot < L_GPSReadSide::MAX_READERS;++ mSlot)
+		{
+			bool isUsed = false;
+			if (mReadSide.mIsSlotUsed[mSlot].compare_exchange_strong(isUsed,true))
+				return;
+		}
+		throw new std::runtime_error("Too many concurrent readers.");
+	}
+	~L_GPSSimReader()
+	{
+		mReadSide.mIsSlotUsed[mSlot] = false;
+	}
+	//! function to get the virtual time at the last event
+	double CurrentVirtualTime()
+	{
+		double VTime;
+		uint64_t sequence;
+		do{
+			sequence = BeginRead();
+			VTime = mSim.mOldVTime;
+		}while (IsChanged(sequence));
+		return VTime;
+	}
+	//! function to get the total weight of the backlogged flows right after the last event
+	double SumWeight()
+	{
+		double sumWeight;
+		uint64_t sequence;
+		do{
+			sequence = BeginRead();
+			sumWeight = mSim.mSumWeight;
+		}while (IsChanged(sequence));
+		return sumWeight;
+	}
+	//! function to compute the virtual time at real time NewRTime, which is no earlier than the last event
+	/*! the same as L_GPSSim::RTime2VTime(). The tree may be modified during the descent, in 
+		which case the result is discarded and the descent restarts; the reader announces 
+		its epoch first, so the nodes it may visit are not freed meanwhile. If pUpdateNum 
+		is not NULL, it receives the number of updates (i.e., of the calls protected by the
+		seqlock, see L_GPSSim::EnableConcurrentReaders()) made since the readers were enabled
+		and before the state the result is computed from.
+	*/
+	double RTime2VTime(double NewRTime,uint64_t* pUpdateNum = NULL)
+	{
+		const int MAX_PATH_LENGTH = BreakPointTree::MAX_PATH_LENGTH;
+		double eps = 1e-8;
+		double VTime;
+		uint64_t sequence;
+		mReadSide.mReaderEpochs[mSlot].store(mReadSide.mEpoch.load());
+		do{
+			sequence = BeginRead();
+			double oldVTime = mSim.mOldVTime,
+				   oldRTime = mSim.mOldRTime,
+				   oldSumWeight = mSim.mSumWeight;
+			BreakPointTreeNode *pCurNode = mSim.mpBalancedTree->GetRoot();
+			if (pCurNode == NULL || std::fabs(oldSumWeight) <= eps)
+			{
+				VTime = oldVTime;
+				continue;
+			}
+			//! the depth is bounded as the nodes read during an update may not form a tree
+			int depth = 0;
+			//! every link is loaded once (with acquire semantics, see NodeLink), so the node it reaches is initialized
+			BreakPointTreeNode *pLeft, *pRight;
+			while ((pLeft = pCurNode->left) != NULL && (pRight = pCurNode->right) != NULL && depth ++ < MAX_PATH_LENGTH)
+			{
+				double RTimeLMax = oldRTime + (pLeft->data.mVTimeMax - oldVTime) * oldSumWeight - pLeft->data.mDeltaRTime;
+				if (NewRTime < RTimeLMax)
+					pCurNode = pLeft;
+				else
+				{
+					oldSumWeight += pLeft->data.mDeltaWeight;
+					oldVTime = pLeft->data.mVTimeMax;
+					oldRTime = RTimeLMax;
+					pCurNode = pRight;
+				}
+			}
+			VTime = oldVTime + (NewRTime - oldRTime) / oldSumWeight;
+		}while (IsChanged(sequence));
+		mReadSide.mReaderEpochs[mSlot].store(0);
+		if (pUpdateNum != NULL)
+			*pUpdateNum = sequence / 2;
+		return VTime;
+	}
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+/*
+	Hierarchical GPS (H-GPS) simulator built from nested L_GPSSim instances.
+
+	The link is shared by a tree of classes (e.g., tenants -> applications -> flows):
+	every class shares the service it receives among its backlogged children (classes
+	or flows) in proportion to their weights. Each class runs its own L-GPS virtual
+	clock, whose "real time" is the amount of service received by the class (the
+	root class receives the whole link, so its real time is the real time).
+
+	A class c is a flow of its parent p: it has a weight, a cumulative amount of
+	arrived work A_c and the virtual finish time F_c (in the virtual time of p) of its
+	last arrival. Since a backlogged flow of weight w receives w units of service per
+	unit of virtual time, the service received by c up to the real time at which p's
+	virtual time is V equals
+		S_c = A_c - w_c * max(0, F_c - V).
+	Therefore, upon the arrival of a packet, the classes on the path from the root to
+	the packet's leaf class are visited top-down: each of them handles the packet as an
+	arrival of its child on the path and passes S_child down as the child's real time.
+	The cost is O(depth * log n) per packet.
+
+	Class configuration file:
+		n <class ID> <parent class ID> <weight>   declares a class (class 0 is the root,
+		                                          parents must be declared before children)
+		l <flow ID> <class ID>                    attaches a flow to a class (flows which
+		                                          are not attached belong to the root)
+		c ...                                     comments
+	Flow weights are the ones given in the packet trace.
+*/
+#ifndef L_HGPS_HPP
+#define L_HGPS_HPP
+
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <stdexcept> // for runtime_error
+#include <algorithm> // for reverse
+
+#include "L_GPSsim.hpp"
+
+//! class for a class in the H-GPS hierarchy
+class HGPSClass{
+public:
+	//! ID of this class (0 for the root)
+	int mClassId;
+	//! parent class (NULL for the root)
+	HGPSClass *mpParent;
+	//! weight of this class in its parent
+	double mWeight;
+	//! GPS simulator sharing the service of this class among its children
+	L_GPSSim *mpSimulator;
+	//! total amount of work arrived to this class
+	double mArrivedWork;
+	//! virtual finish time (in the parent's virtual time) of the last arrival to this class
+	double mLastDepartVTime;
+	//! classes from the root to this class
+	std::vector<HGPSClass *> mPath;
+	//! constructor
+	HGPSClass(int classId,HGPSClass *pParent,double weight)
+	{
+		if (weight <= 0)
+			throw new std::runtime_error("Cannot create class with negative or zero weight.");
+		mClassId = classId;
+		mpParent = pParent;
+		mWeight = weight;
+		mpSimulator = new L_GPSSim();
+		mArrivedWork = 0.0;
+		mLastDepartVTime = 0.0;
+		for (HGPSClass *c = this;c != NULL;c = c->mpParent)
+			mPath.push_back(c);
+		std::reverse(mPath.begin(),mPath.end());
+	}
+	~HGPSClass()
+	{
+		delete mpSimulator;
+	}
+};
+
+//! class for the hierarchical GPS simulator
+class L_HGPSSim{
+	//! classes, indexed by class ID
+	std::map<int,HGPSClass *> mClasses;
+	//! weight of each flow
+	std::vector<double> mFlowWeights;
+	//! leaf class of each flow
+	std::vector<HGPSClass *> mFlow2Class;
+	//! virtual finish time (in the virtual time of its class) of the last packet of each flow
+	std::vector<double> mFlowLastDepartVTimes;
+	//! function to read the class configuration
+	void readConfiguration(const std::string& conf)
+	{
+		std::ifstream infile(conf);
+		if (!infile.is_open())
+			throw new std::runtime_error("Cannot open class configuration file.");
+		std::string lines;
+		int classId, parentId, flowId;
+		double weight;
+		char c;
+		while (infile >> c)
+		{
+			switch(c)
+			{
+				case 'n':// class description
+					if (!(infile >> classId >> parentId >> weight))
+						throw new std::runtime_error("Missing or wrong class description.");
+					if (mClasses.count(classId))
+						throw new std::runtime_error("Duplicate class declaration.");
+					if (!mClasses.count(parentId))
+						throw new std::runtime_error("Parent class must be declared before its children.");
+					mClasses[classId] = new HGPSClass(classId,mClasses[parentId],weight);
+					break;
+				case 'l':// flow to class mapping
+					if (!(infile >> flowId >> classId))
+						throw new std::runtime_error("Missing or wrong flow attachment.");
+					if (flowId < 1 || flowId > (int)mFlowWeights.size())
+						throw new std::runtime_error("Cannot attach unknown flow.");
+					if (!mClasses.count(classId))
+						throw new std::runtime_error("Cannot attach flow to unknown class.");
+					mFlow2Class[flowId - 1] = mClasses[classId];
+					break;
+				case 'c':// comments
+					break;
+				default:// unknown
+					throw new std::runtime_error("Unknown declaration.");
+			}
+			std::getline(infile,lines);
+		}
+	}
+public:
+	//! constructor
+	/*! conf is the path of the class configuration file (an empty path gives a single
+		flat class, i.e., plain GPS)
+	*/
+	L_HGPSSim(const std::vector<double>& flowWeights,const std::string& conf = "")
+	{
+		mFlowWeights = flowWeights;
+		mFlowLastDepartVTimes.resize(flowWeights.size());
+		mClasses[0] = new HGPSClass(0,NULL,1.0);
+		mFlow2Class.assign(flowWeights.size(),mClasses[0]);
+		if (conf.empty()) return;
+		try{
+			readConfiguration(conf);
+		}
+		catch(...)
+		{
+			for (auto& c: mClasses)
+				delete c.second;
+			throw;
+		}
+	}
+	~L_HGPSSim()
+	{
+		for (auto& c: mClasses)
+			delete c.second;
+	}
+	//! function to handle the event of packet arrival
+	/*! returns the virtual finish time of the packet in the virtual time of its leaf class
+	*/
+	double HandleNewPacketArrival(Packet* pPKT)
+	{
+		if (pPKT->mFlowId < 1 || pPKT->mFlowId > (int)mFlowWeights.size())
+			throw new std::runtime_error("Packet belongs to an unknown flow.");
+		std::vector<HGPSClass *>& path = mFlow2Class[pPKT->mFlowId - 1]->mPath;
+		double packetLength = pPKT->mLength;
+		//! real time of the current class, i.e., the amount of service it received
+		double classRTime = pPKT->mArrivalTime;
+		for (size_t i = 0;i + 1 < path.size();++ i)
+		{
+			HGPSClass *pChild = path[i + 1];
+			double lastDepartVTime = pChild->mLastDepartVTime;
+			double curVTime;
+			path[i]->mpSimulator->HandleNewArrival(classRTime,packetLength,pChild->mWeight,pChild->mLastDepartVTime,&curVTime);
+			//! service received by the child before this packet arrives
+			double backlog = lastDepartVTime > curVTime ? (lastDepartVTime - curVTime) * pChild->mWeight : 0.0;
+			classRTime = pChild->mArrivedWork - backlog;
+			pChild->mArrivedWork += packetLength;
+		}
+		double& flowLastDepartVTime = mFlowLastDepartVTimes[pPKT->mFlowId - 1];
+		return path.back()->mpSimulator->HandleNewArrival(classRTime,packetLength,mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+	}
+	//! get the class with a given ID (NULL if there is no such class)
+	HGPSClass* GetClass(int classId)
+	{
+		auto it = mClasses.find(classId);
+		if (it == mClasses.end()) return NULL;
+		return it->second;
+	}
+	//! get the leaf class of a flow
+	HGPSClass* GetFlowClass(int flowId)
+	{
+		return mFlow2Class[flowId - 1];
+	}
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+	Stable sorting of packets by arrival time.
+
+	Since arrival times are integers and traces are usually sorted, nearly sorted or
+	sorted per flow, SortPacketsByArrival() picks the cheapest of:
+	1. nothing, if the packets are already sorted (a single linear scan);
+	2. a natural merge sort, if the packets consist of a few sorted runs;
+	3. an LSD radix sort on the arrival time (8 bits per pass, passes on digits
+	   shared by all the keys are skipped), parallelized for large inputs.
+	All of them are stable, i.e., packets with equal arrival times keep their input order.
+*/
+#ifndef ARRIVAL_SORT_HPP
+#define ARRIVAL_SORT_HPP
+
+#include <vector>
+#include <thread>
+#include <algorithm> // for merge, max, min
+#include <cstring> // for memset
+#include <functional>
+
+#include "packet.hpp"
+
+//! class implementing the stable sorts of packets by arrival time
+class ArrivalSorter{
+	//! element sorted by the radix sort: key (arrival time - minimum arrival time) and packet
+	struct KeyedPacket{
+		unsigned long key;
+		Packet *pPKT;
+	};
+	//! number of bits per radix pass
+	static const int RADIX_BITS = 8;
+	static const int RADIX_SIZE = 1 << RADIX_BITS;
+	//! minimum number of packets per thread for a parallel radix pass
+	static const size_t PARALLEL_GRAIN = 1 << 16;
+
+	//! function to find the boundaries of the maximal non-decreasing runs
+	static void findRuns(std::vector<Packet *>& packets,std::vector<size_t>& runs,size_t maxRuns)
+	{
+		runs.clear();
+		runs.push_back(0);
+		for (size_t i = 1;i < packets.size();++ i)
+			if (packets[i]->mArrivalTime < packets[i - 1]->mArrivalTime)
+			{
+				runs.push_back(i);
+				if (runs.size() > maxRuns) return;
+			}
+		runs.push_back(packets.size());
+	}
+	//! function to merge neighbouring runs pairwise until a single run is left
+	static void mergeRuns(std::vector<Packet *>& packets,std::vector<size_t>& runs)
+	{
+		PKT_Compare_AT_L less;
+		std::vector<Packet *> buffer(packets.size());
+		std::vector<Packet *> *pFrom = &packets, *pTo = &buffer;
+		while (runs.size() > 2)
+		{
+			std::vector<size_t> merged;
+			size_t i = 0;
+			for (;i + 2 < runs.size();i += 2)
+			{
+				std::merge(pFrom->begin() + runs[i],pFrom->begin() + runs[i + 1],
+						   pFrom->begin() + runs[i + 1],pFrom->begin() + runs[i + 2],
+						   pTo->begin() + runs[i],less);
+				merged.push_back(runs[i]);
+			}
+			if (i + 1 < runs.size())
+			{//! odd run out
+				std::copy(pFrom->begin() + runs[i],pFrom->begin() + runs[i + 1],pTo->begin() + runs[i]);
+				merged.push_back(runs[i]);
+			}
+			merged.push_back(packets.size());
+			runs.swap(merged);
+			std::swap(pFrom,pTo);
+		}
+		if (pFrom != &packets)
+			packets.swap(buffer);
+	}
+	//! function to build the histogram of one digit for the elements in [begin,end)
+	static void histogram(const KeyedPacket* begin,const KeyedPacket* end,int shift,size_t* counts)
+	{
+		std::memset(counts,0,sizeof(size_t) * RADIX_SIZE);
+		for (const KeyedPacket *p = begin;p < end;++ p)
+			++ counts[(p->key >> shift) & (RADIX_SIZE - 1)];
+	}
+	//! function to scatter the elements in [begin,end) to their buckets
+	static void scatter(const KeyedPacket* begin,const KeyedPacket* end,int shift,size_t* offsets,KeyedPacket* to)
+	{
+		for (const KeyedPacket *p = begin;p < end;++ p)
+			to[offsets[(p->key >> shift) & (RADIX_SIZE - 1)] ++] = *p;
+	}
+	//! function to perform the LSD radix sort
+	static void radixSort(std::vector<Packet *>& packets,unsigned threadNum)
+	{
+		size_t n = packets.size();
+		long int minTime = packets[0]->mArrivalTime, maxTime = minTime;
+		for (auto pPKT: packets)
+		{
+			minTime = std::min(minTime,pPKT->mArrivalTime);
+			maxTime = std::max(maxTime,pPKT->mArrivalTime);
+		}
+		std::vector<KeyedPacket> from(n), to(n);
+		for (size_t i = 0;i < n;++ i)
+		{
+			from[i].key = (unsigned long)(packets[i]->mArrivalTime - minTime);
+			from[i].pPKT = packets[i];
+		}
+		unsigned long range = (unsigned long)(maxTime - minTime);
+
+		//! every thread handles a contiguous block, which keeps the sort stable
+		size_t blockNum = std::max<size_t>(1,std::min<size_t>(threadNum,n / PARALLEL_GRAIN));
+		std::vector<size_t> counts(blockNum * RADIX_SIZE);
+		for (int shift = 0;shift < (int)(sizeof(unsigned long) * 8) && (range >> shift) != 0;shift += RADIX_BITS)
+		{
+			KeyedPacket *src = from.data();
+			auto blockBegin = [&](size_t b){ return src + n * b / blockNum; };
+			auto parallelFor = [&](std::function<void(size_t)> task){
+				std::vector<std::thread> threads;
+				for (size_t b = 1;b < blockNum;++ b)
+					threads.push_back(std::thread(task,b));
+				task(0);
+				for (auto& t: threads)
+					t.join();
+			};
+			parallelFor([&](size_t b){ histogram(blockBegin(b),blockBegin(b + 1),shift,&counts[b * RADIX_SIZE]); });
+
+			//! skip the pass if all the keys share this digit
+			bool isTrivial = false;
+			for (int d = 0;d < RADIX_SIZE && !isTrivial;++ d)
+			{
+				size_t total = 0;
+				for (size_t b = 0;b < blockNum;++ b)
+					total += counts[b * RADIX_SIZE + d];
+				isTrivial = (total == n);
+			}
+			if (isTrivial) continue;
+
+			//! exclusive prefix sum in (digit, block) order
+			size_t offset = 0;
+			for (int d = 0;d < RADIX_SIZE;++ d)
+				for (size_t b = 0;b < blockNum;++ b)
+				{
+					size_t c = counts[b * RADIX_SIZE + d];
+					counts[b * RADIX_SIZE + d] = offset;
+					offset += c;
+				}
+			parallelFor([&](size_t b){ scatter(blockBegin(b),blockBegin(b + 1),shift,&counts[b * RADIX_SIZE],to.data()); });
+			from.swap(to);
+		}
+		for (size_t i = 0;i < n;++ i)
+			packets[i] = from[i].pPKT;
+	}
+public:
+	//! function to stably sort packets by arrival time with at most threadNum threads
+	static void sort(std::vector<Packet *>& packets,unsigned threadNum = 1)
+	{
+		if (packets.size() < 2) return;
+		if (threadNum == 0)
+			threadNum = std::max(1u,std::thread::hardware_concurrency());
+		//! a merge pass costs about as much as a radix pass, hence a few runs are worth merging
+		size_t maxRuns = 16;
+		std::vector<size_t> runs;
+		findRuns(packets,runs,maxRuns);
+		if (runs.size() == 2) return;// already sorted
+		if (runs.back() == packets.size() && runs.size() <= maxRuns + 1)
+			mergeRuns(packets,runs);
+		else
+			radixSort(packets,threadNum);
+	}
+};
+
+//! function to stably sort packets by arrival time
+inline void SortPacketsByArrival(std::vector<Packet *>& packets,unsigned threadNum = 1)
+{
+	ArrivalSorter::sort(packets,threadNum);
+}
+
+#endif
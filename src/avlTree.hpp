@@ -9,95 +9,145 @@
 #define AVL_TREE_HPP
 
 
+#include <thread>
+#include <algorithm> // for lower_bound
+
 #include "bst.hpp"
 
+//! Default aggregation policy of AVL_Tree: plain tree keeping an element in every node
+/*! An aggregation policy must provide
+	- IS_LEAF_ORIENTED: whether the elements are kept in the leaves only, while every
+	  internal node has two children and keeps the aggregates of its subtree (the 
+	  aggregates are supported by leaf-oriented trees only);
+	- combine(parent,left,right): function to recompute the aggregates of an internal
+	  node from its children, returns whether they changed;
+	- merge(leaf,data): function to merge the element data into the leaf of the same key;
+	- isVoid(leaf): function to tell whether a leaf no longer carries anything after a
+	  merge, in which case mergeIntoLeaf() removes it.
+	All of them are static and inlined, hence a plain tree pays nothing for them.
+*/
+template <class T>
+struct NoAugmentation{
+	static const bool IS_LEAF_ORIENTED = false;
+	static inline bool combine(T& parent,const T& left,const T& right)
+	{
+		return false;
+	}
+	static inline void merge(T& leaf,const T& data)
+	{
+	}
+	static inline bool isVoid(const T& leaf)
+	{
+		return false;
+	}
+};
+
 //! A class for AVL Tree
 /*!
  	Generic AVL Tree.
 	Can be used with an customized comparator instead of the natural order,
 	but the generic Value type must still be comparable.
+	Augment is the aggregation policy (see NoAugmentation), and Links the link policy
+	(see PlainLinks).
 */
-template <class T,class Compare = std::less<T> >
-class AVL_Tree: public BST<T,Compare>
+template <class T,class Compare = std::less<T>,class Augment = NoAugmentation<T>,class Links = PlainLinks>
+class AVL_Tree: public BST<T,Compare,Links>
 {
+	//! left spine of the tree, i.e., the nodes from the root to the leftmost leaf (the smallest element)
+	/*! only maintained by leaf-oriented trees */
+	std::vector<node<T,Links>*> mLeftSpine;
+	//! list receiving the nodes removed from the tree instead of freeing them (NULL to free them)
+	std::vector<node<T,Links>*>* mpRetiredNodes;
+	//! Function to free a node removed from the tree, or to retire it if concurrent readers may still visit it
+	void freeNode(node<T,Links>* current)
+	{
+		if (mpRetiredNodes != NULL)
+			mpRetiredNodes->push_back(current);
+		else
+			delete current;
+	}
+	//! Function to free (or retire) all the nodes of the subtree rooted at current
+	void freeNodes(node<T,Links>* current)
+	{
+		if (current == NULL) return;
+		freeNodes(current->left);
+		freeNodes(current->right);
+		freeNode(current);
+	}
 public:
 	//! A constructor 
-	AVL_Tree(Compare uLess = Compare()):BST<T,Compare>(uLess){}
+	AVL_Tree(Compare uLess = Compare()):BST<T,Compare,Links>(uLess),mpRetiredNodes(NULL){}
 	//! A constructor
-	AVL_Tree(std::vector<T>& data,Compare uLess = Compare()){
-		this->root = NULL;
-		this->Less = uLess;
+	AVL_Tree(std::vector<T>& data,Compare uLess = Compare()):BST<T,Compare,Links>(uLess),mpRetiredNodes(NULL){
 		for (auto d : data)
 			insert(d);
-		this->mSize = data.size();
 	}
 	//! A function to insert a new element in the AVL Tree
 	void insert(T& data)
 	{
+		if (Augment::IS_LEAF_ORIENTED)
+		{
+			insertIterative(data);
+			return;
+		}
 		if (this->empty())
-			this->root = new node<T>(data);
+			this->root = new node<T,Links>(data);
 		else
 			this->root = insert(this->root,data);
 		++ this->mSize;
 	}
 	//! A recursive function to insert an element in the subtree rooted at current, perform rotation if necessary
-	node<T>* insert(node<T> *current,T& data)
+	node<T,Links>* insert(node<T,Links> *current,T& data)
 	{
 		//! insert the new element
-#ifdef AUGMENTED_L_GPS
-		if (IsLeaf(current))
-		{// reach leaf node
-			if (Less(data,current->data))
-			{
-				current->right = new node<T>(current->data);
-				current->left = new node<T>(data);
-			}
-			else if (Less(current->data,data))
-			{
-				current->left = new node<T>(current->data);
-				current->right = new node<T>(data);
+		if (Augment::IS_LEAF_ORIENTED)
+		{
+			if (IsLeaf(current))
+			{// reach leaf node
+				if (this->Less(data,current->data))
+				{
+					current->right = new node<T,Links>(current->data);
+					current->left = new node<T,Links>(data);
+				}
+				else if (this->Less(current->data,data))
+				{
+					current->left = new node<T,Links>(current->data);
+					current->right = new node<T,Links>(data);
+				}
+				else
+				{
+					Augment::merge(current->data,data);
+				}
+				current->height = std::max(height(current->left),height(current->right)) + 1;
+				updateAugmentedMembers(current);
+				return current;				
 			}
+			//! the key of an internal node is the maximum of its subtree, hence compare with the left subtree
+			if (!this->Less(current->left->data,data))
+				current->left = insert(current->left,data);
 			else
-			{
-				current->data.mDeltaWeight += data.mDeltaWeight;
-			}
+				current->right = insert(current->right,data);
 			current->height = std::max(height(current->left),height(current->right)) + 1;
 			updateAugmentedMembers(current);
-			return current;				
+			//! the inserted element is not kept in the internal nodes, hence check the heights of the children instead
+			return rebalance(current);
 		}
-#else
-		if (current == NULL)
-			return (new node<T>(data));
-#endif
 
-#ifdef AUGMENTED_L_GPS
-		if (Less(data,current->data))
-			current->left = insert(current->left,data);
-		else if (Less(current->data,data))
-			current->right = insert(current->right,data);
-		else
-		{
-			current->data.mDeltaWeight += data.mDeltaWeight;
-			return current;
-		}		
-#else
-		if (Less(data,current->data))
+		if (current == NULL)
+			return (new node<T,Links>(data));
+		if (this->Less(data,current->data))
 			current->left = insert(current->left,data);
 		else
 			current->right = insert(current->right,data);
-#endif
 		//! update height
 		current->height = std::max(height(current->left),height(current->right)) + 1;
 
-#ifdef AUGMENTED_L_GPS
-		updateAugmentedMembers(current);
-#endif
 		//! check whether rotation is needed
 		int balance = heightDif(current);
 
 		if (balance > 1)
 		{//! left-heavy
-			if (Less(data,current->left->data))
+			if (this->Less(data,current->left->data))
 			{//! left-heavy
 				return right_rotate(current);
 			}
@@ -109,7 +159,7 @@ public:
 		}
 		else if (balance < -1)
 		{//! right-heavy
-			if (Less(data,current->right->data))
+			if (this->Less(data,current->right->data))
 			{//!left-heavy
                current->right = right_rotate(current->right);
                return left_rotate(current);
@@ -124,46 +174,210 @@ public:
 
 	}
 	//! A function to perform left rotate at current node
-	node<T>* left_rotate(node<T>* current)
+	node<T,Links>* left_rotate(node<T,Links>* current)
 	{
-		node<T>* right = current->right;
+		node<T,Links>* right = current->right;
 		current->right = right->left;
 		right->left = current;
 
 		current->height = std::max(height(current->left),height(current->right)) + 1;
 		right->height = std::max(height(right->left),height(right->right)) + 1;
 
-#ifdef AUGMENTED_L_GPS
-
 		updateAugmentedMembers(current);
 		updateAugmentedMembers(right);
 
-#endif
 		return right;
 	}
-#ifdef AUGMENTED_L_GPS
-	inline void updateAugmentedMembers(node<T>* current)
+	//! Function to recompute the augmented members of current from its children, returns whether they changed
+	inline bool updateAugmentedMembers(node<T,Links>* current)
 	{
-		if (IsLeaf(current)) return;
-		current->data.mVTimeMax = current->right->data.mVTimeMax;
-		current->data.mDeltaWeight = current->left->data.mDeltaWeight + current->right->data.mDeltaWeight;
-		current->data.mDeltaRTime = current->left->data.mDeltaRTime + current->right->data.mDeltaRTime - (current->right->data.mVTimeMax - current->left->data.mVTimeMax) * current->left->data.mDeltaWeight;
+		if (!Augment::IS_LEAF_ORIENTED || IsLeaf(current)) return false;
+		return Augment::combine(current->data,current->left->data,current->right->data);
+	}
+	//! Function to rotate the subtree rooted at current if it is unbalanced, returns the new root of the subtree
+	node<T,Links>* rebalance(node<T,Links>* current)
+	{
+		int balance = heightDif(current);
+		if (balance > 1)
+		{//! left-heavy
+			if (heightDif(current->left) >= 0)
+				return right_rotate(current);
+			current->left = left_rotate(current->left);
+			return right_rotate(current);
+		}
+		else if (balance < -1)
+		{//! right-heavy
+			if (heightDif(current->right) <= 0)
+				return left_rotate(current);
+			current->right = right_rotate(current->right);
+			return left_rotate(current);
+		}
+		return current;
+	}
+	//! maximum depth of the tree supported by the iterative functions
+	/*! an AVL tree of height h has at least F(h + 2) - 1 nodes (F being the Fibonacci 
+		numbers), hence no tree fitting in memory is deeper than this
+	*/
+	static const int MAX_PATH_LENGTH = 128;
+	//! Function to fix the nodes path[0..depth-1] bottom-up after the subtree below path[depth-1] changed
+	/*! the heights are updated and the nodes are rebalanced only as long as the heights change
+		(a subtree of unchanged height cannot unbalance its ancestors), after that only the 
+		augmented members are updated, and the walk stops as soon as they do not change either.
+		Returns the smallest index of the path at which a rotation happened (depth if none).
+	*/
+	int fixPath(node<T,Links>** path,int depth)
+	{
+		int rotated = depth;
+		bool isHeightChanged = true;
+		for (int i = depth - 1;i >= 0;-- i)
+		{
+			node<T,Links>* current = path[i];
+			if (isHeightChanged)
+			{
+				int oldHeight = current->height;
+				current->height = std::max(height(current->left),height(current->right)) + 1;
+				updateAugmentedMembers(current);
+				node<T,Links>* subRoot = rebalance(current);
+				if (subRoot != current)
+				{//! link the new root of the subtree to its parent
+					rotated = i;
+					if (i == 0)
+						this->root = subRoot;
+					else if (path[i - 1]->left == current)
+						path[i - 1]->left = subRoot;
+					else
+						path[i - 1]->right = subRoot;
+				}
+				isHeightChanged = (subRoot->height != oldHeight);
+			}
+			else if (!updateAugmentedMembers(current))
+				break;
+		}
+		return rotated;
+	}
+	//! Function to insert data iteratively, merging it with the leaf of the same key if there is one
+	void insertIterative(T& data)
+	{
+		if (this->empty())
+		{
+			this->root = new node<T,Links>(data);
+			mLeftSpine.assign(1,this->root);
+			++ this->mSize;
+			return;
+		}
+		node<T,Links>* path[MAX_PATH_LENGTH];
+		int depth = 0;
+		//! number of nodes of the path on the left spine
+		int spineDepth = 0;
+		bool isOnSpine = true;
+		node<T,Links>* current = this->root;
+		//! the key of an internal node is the maximum of its subtree, hence compare with the left subtree
+		while (!IsLeaf(current))
+		{
+			assert(depth < MAX_PATH_LENGTH);
+			path[depth ++] = current;
+			if (isOnSpine) spineDepth = depth;
+			current = this->Less(current->left->data,data) ? current->right : current->left;
+			isOnSpine = isOnSpine && current == mLeftSpine[depth];
+		}
+		if (this->Less(data,current->data))
+		{
+			current->right = new node<T,Links>(current->data);
+			current->left = new node<T,Links>(data);
+		}
+		else if (this->Less(current->data,data))
+		{
+			current->left = new node<T,Links>(current->data);
+			current->right = new node<T,Links>(data);
+		}
+		else
+		{//! merge with the existing element, the height does not change
+			Augment::merge(current->data,data);
+			path[depth ++] = current;
+			fixPath(path,depth);
+			return;
+		}
+		++ this->mSize;
+		current->height = 1;
+		updateAugmentedMembers(current);
+		//! the split leaf is now an internal node, and the leaves do not move on rotations
+		if (current == mLeftSpine.back())
+			mLeftSpine.push_back(current->left);
+		int rotated = fixPath(path,depth);
+		//! a rotation at a node of the left spine changes the spine below it
+		if (rotated < spineDepth)
+			rebuildLeftSpine(rotated);
+	}
+	//! Function to merge data into the leaf of the same key, returns false if there is no such leaf
+	/*! if the merged leaf is void (see the aggregation policy), it is removed, so that
+		the tree does not keep leaves which carry nothing. Only for leaf-oriented trees.
+	*/
+	bool mergeIntoLeaf(T& data)
+	{
+		if (this->empty()) return false;
+		node<T,Links>* path[MAX_PATH_LENGTH];
+		int depth = 0;
+		node<T,Links>* current = this->root;
+		while (!IsLeaf(current))
+		{
+			assert(depth < MAX_PATH_LENGTH);
+			path[depth ++] = current;
+			current = this->Less(current->left->data,data) ? current->right : current->left;
+		}
+		if (this->Less(data,current->data) || this->Less(current->data,data)) return false;
+		Augment::merge(current->data,data);
+		if (Augment::isVoid(current->data))
+			removeLeaf(path,depth,current);
+		else
+		{//! the height does not change
+			path[depth ++] = current;
+			fixPath(path,depth);
+		}
+		return true;
+	}
+	//! Function to remove the leaf whose ancestors are path[0..depth-1], its parent is replaced by its sibling
+	void removeLeaf(node<T,Links>** path,int depth,node<T,Links>* leaf)
+	{
+		-- this->mSize;
+		freeNode(leaf);
+		if (depth == 0)
+		{
+			this->root = NULL;
+			mLeftSpine.clear();
+			return;
+		}
+		//! number of ancestors on the left spine
+		int spineDepth = 0;
+		while (spineDepth < depth && spineDepth < (int)mLeftSpine.size() && path[spineDepth] == mLeftSpine[spineDepth])
+			++ spineDepth;
+		node<T,Links>* parent = path[-- depth];
+		node<T,Links>* sibling = parent->left == leaf ? parent->right : parent->left;
+		if (depth == 0)
+			this->root = sibling;
+		else if (path[depth - 1]->left == parent)
+			path[depth - 1]->left = sibling;
+		else
+			path[depth - 1]->right = sibling;
+		freeNode(parent);
+		int rotated = fixPath(path,depth);
+		//! the sibling takes the place of the parent, which changes the spine if the parent was on it
+		if (spineDepth > depth)
+			rebuildLeftSpine(std::min(rotated,depth));
+		else if (rotated < spineDepth)
+			rebuildLeftSpine(rotated);
 	}
-#endif
 	//! A function to perform right rotate at current node
-	node<T>* right_rotate(node<T>* current)
+	node<T,Links>* right_rotate(node<T,Links>* current)
 	{
-		node<T>* left = current->left;
+		node<T,Links>* left = current->left;
 		current->left = left->right;
 		left->right = current;
 
 		current->height = std::max(height(current->left),height(current->right)) + 1;
 		left->height = std::max(height(left->left),height(left->right)) + 1;
 
-#ifdef AUGMENTED_L_GPS
 		updateAugmentedMembers(current);
 		updateAugmentedMembers(left);
-#endif 
 		return left;
 	}
 	int height()
@@ -171,165 +385,504 @@ public:
 		return height(this->root);
 	}
 	//! A function to obtain the height of current node
-	int height(node<T>* current)
+	int height(node<T,Links>* current)
 	{
 		if (current == NULL) return -1;
 		return current->height;
 	}
 	//! A function to obtain the height difference between left and right child
-	int heightDif(node<T>* current)
+	int heightDif(node<T,Links>* current)
 	{
 		if (current == NULL) return 0;
 		return height(current->left) - height(current->right);
 
 	}
-	//! A function to remove data in the AVL Tree
+	//! A function to remove the element of the same key as data in the AVL Tree, data receives it
+	/*! throws a run time error if there is no such element. O(log n) in both kinds of tree.
+	*/
 	void remove(T& data)
 	{
+		if (Augment::IS_LEAF_ORIENTED)
+		{
+			node<T,Links>* path[MAX_PATH_LENGTH];
+			int depth = 0;
+			node<T,Links>* leaf = findLeaf(data,path,depth);
+			if (leaf == NULL)
+				throw new std::runtime_error("Cannot remove non-exist element");
+			data = leaf->data;
+			removeLeaf(path,depth,leaf);
+			return;
+		}
 		this->root = remove(this->root,data);
 		-- this->mSize;
 	}
-#ifdef AUGMENTED_L_GPS
-	//! Function to remove the leftmost leaf in the tree if it is no greater than data
-	bool removeLeftmostLeafIfNecessary(T& data)
+	//! Function to find the leaf of the same key as data, NULL if there is none (leaf-oriented trees only)
+	node<T,Links>* findLeaf(T& data)
 	{
-		if (this->empty()) return false;
-		if (this->root->left == NULL)
+		node<T,Links>* path[MAX_PATH_LENGTH];
+		int depth = 0;
+		return findLeaf(data,path,depth);
+	}
+	//! Function to find the leaf of the same key as data, path[0..depth-1] receive its ancestors
+	node<T,Links>* findLeaf(T& data,node<T,Links>** path,int& depth)
+	{
+		depth = 0;
+		if (this->empty()) return NULL;
+		node<T,Links>* current = this->root;
+		//! the key of an internal node is the maximum of its subtree, hence compare with the left subtree
+		while (!IsLeaf(current))
 		{
-			if (!Less(data, this->root->data))
-			{
-				data = this->root->data;
-				this->root = this->root->right;
-			}
-			else
-				return false;
+			assert(depth < MAX_PATH_LENGTH);
+			path[depth ++] = current;
+			current = this->Less(current->left->data,data) ? current->right : current->left;
+		}
+		if (this->Less(data,current->data) || this->Less(current->data,data)) return NULL;
+		return current;
+	}
+	//! Function to move the element of the same key as oldData to the key of newData, which replaces it
+	/*! returns false (and changes nothing) if there is no element of the key of oldData.
+		In a leaf-oriented tree, if the new key still lies between the neighbours of the
+		leaf, the leaf is updated in place and only the aggregates on its path are fixed,
+		otherwise it is removed and newData is inserted (merged if its key exists).
+		O(log n) in both cases.
+	*/
+	bool updateKey(T& oldData,T& newData)
+	{
+		if (!Augment::IS_LEAF_ORIENTED)
+		{
+			node<T,Links>* current = this->root;
+			while (current != NULL && (this->Less(oldData,current->data) || this->Less(current->data,oldData)))
+				current = this->Less(oldData,current->data) ? current->left : current->right;
+			if (current == NULL) return false;
+			remove(oldData);
+			insert(newData);
 			return true;
 		}
-		bool isRemoved = false;
-		this->root = removeLeftmostLeafIfNecessary(this->root,data,isRemoved);
-		return isRemoved;
-
+		node<T,Links>* path[MAX_PATH_LENGTH];
+		int depth = 0;
+		node<T,Links>* leaf = findLeaf(oldData,path,depth);
+		if (leaf == NULL) return false;
+		//! the neighbours are the maximum of the left subtree of the deepest ancestor where the path goes right, and the minimum of the right subtree of the deepest one where it goes left
+		node<T,Links>* previous = NULL;
+		node<T,Links>* next = NULL;
+		for (int i = depth - 1;i >= 0 && (previous == NULL || next == NULL);-- i)
+		{
+			node<T,Links>* child = i == depth - 1 ? leaf : path[i + 1];
+			if (path[i]->right == child && previous == NULL)
+				previous = path[i]->left;
+			else if (path[i]->left == child && next == NULL)
+				next = path[i]->right;
+		}
+		while (next != NULL && !IsLeaf(next))
+			next = next->left;
+		if ((previous != NULL && !this->Less(previous->data,newData)) || (next != NULL && !this->Less(newData,next->data)))
+		{
+			removeLeaf(path,depth,leaf);
+			insert(newData);
+			return true;
+		}
+		leaf->data = newData;
+		path[depth ++] = leaf;
+		fixPath(path,depth);
+		return true;
 	}
-	//! Function to remove the leftmost leaf in the tree if it is no greater than data
-	node<T>* removeLeftmostLeafIfNecessary(node<T>* current,T& data,bool& isRemoved)
+	//! Function to collect the leaves (i.e., the elements) of the tree in order
+	void getLeaves(std::vector<T>& leaves)
 	{
-		if (IsLeaf(current->left))
+		std::vector<node<T,Links>*> stack;
+		node<T,Links>* current = this->root;
+		while (current != NULL || !stack.empty())
 		{
-			if (!Less(data,current->left->data))
+			while (current != NULL)
 			{
-				isRemoved = true;
-				data = current->left->data;
-				assert(current->right != NULL);
-				current = current->right;
+				stack.push_back(current);
+				current = current->left;
 			}
-			return current;
+			current = stack.back();
+			stack.pop_back();
+			if (IsLeaf(current))
+				leaves.push_back(current->data);
+			current = current->right;
 		}
-
-		current->left = removeLeftmostLeafIfNecessary(current->left,data,isRemoved);
-
+	}
+	//! Function to free all the nodes
+	void clear()
+	{
+		freeNodes(this->root);
+		this->root = NULL;
+		this->mSize = 0;
+		mLeftSpine.clear();
+	}
+	//! Function to retire the removed nodes into *pRetiredNodes instead of freeing them (NULL to free them again)
+	/*! the retired nodes keep their content, so that a reader descending the tree while it
+		is modified never visits freed memory; the owner of the list frees them once no
+		reader can hold them (see L_GPSSim::EnableConcurrentReaders())
+	*/
+	void setRetiredNodes(std::vector<node<T,Links>*>* pRetiredNodes)
+	{
+		mpRetiredNodes = pRetiredNodes;
+	}
+	//! Function to get the leftmost leaf (i.e., the smallest element) in O(1), NULL if the tree is empty
+	node<T,Links>* getLeftmost()
+	{
+		return mLeftSpine.empty() ? NULL : mLeftSpine.back();
+	}
+	//! Function to get the nodes from the root to the leftmost leaf
+	/*! as the subtree of each of them starts at the leftmost leaf, the spine allows
+		finger searches from the smallest element
+	*/
+	const std::vector<node<T,Links>*>& getLeftSpine()
+	{
+		return mLeftSpine;
+	}
+	//! Function to replace the content of the tree by the sorted elements leaves[0..n-1] in O(n)
+	void buildFromSortedLeaves(const T* leaves,size_t n)
+	{
+		this->clear();
+		if (n == 0) return;
+		this->root = buildFromSortedLeaves(leaves,0,n);
+		this->mSize = n;
+		rebuildLeftSpine(0);
+	}
+	//! Function to rebuild the left spine below its first level nodes mLeftSpine[0..level-1]
+	void rebuildLeftSpine(size_t level)
+	{
+		mLeftSpine.resize(level);
+		node<T,Links>* current = level == 0 ? this->root : mLeftSpine[level - 1]->left;
+		for (;current != NULL;current = current->left)
+			mLeftSpine.push_back(current);
+	}
+	//! Function to build a balanced subtree whose leaves are leaves[lo..hi-1]
+	node<T,Links>* buildFromSortedLeaves(const T* leaves,size_t lo,size_t hi)
+	{
+		T data = leaves[lo];
+		node<T,Links>* current = new node<T,Links>(data);
+		if (hi - lo == 1) return current;
+		//! the sizes of both halves differ by at most one, hence so do their heights
+		size_t mid = lo + (hi - lo) / 2;
+		current->left = buildFromSortedLeaves(leaves,lo,mid);
+		current->right = buildFromSortedLeaves(leaves,mid,hi);
 		current->height = std::max(height(current->left),height(current->right)) + 1;
-
-		int balance = heightDif(current);
-
 		updateAugmentedMembers(current);
-		
-
-		if (balance > 1)
-		{// left-heavy
-			if (heightDif(current->left) >= 0)
-			{// left-heavy or balance
-				return right_rotate(current);
+		return current;
+	}
+	//! Function to append the elements of right, which must all be greater than the ones of this tree, right becomes empty
+	/*! O(|height difference| + 1), only for leaf-oriented trees
+	*/
+	void join(AVL_Tree& right)
+	{
+		if (!Augment::IS_LEAF_ORIENTED)
+			throw new std::runtime_error("Join is only supported by leaf-oriented trees");
+		if (right.empty()) return;
+		assert(this->empty() || this->Less(this->root->data,right.mLeftSpine.back()->data));
+		this->root = join(this->root,right.root);
+		this->mSize += right.mSize;
+		right.root = NULL;
+		right.mSize = 0;
+		right.mLeftSpine.clear();
+		rebuildLeftSpine(0);
+	}
+	//! Function to move the elements greater than data to right (whose elements are dropped first)
+	/*! O(log n) for the tree itself, the sizes of both parts are found by counting the
+		leaves of the smaller one. Only for leaf-oriented trees.
+	*/
+	void split(T& data,AVL_Tree& right)
+	{
+		if (!Augment::IS_LEAF_ORIENTED)
+			throw new std::runtime_error("Split is only supported by leaf-oriented trees");
+		right.clear();
+		node<T,Links>* left = NULL;
+		node<T,Links>* rightRoot = NULL;
+		split(this->root,data,left,rightRoot);
+		this->root = left;
+		right.root = rightRoot;
+		bool isLeftSmaller;
+		size_t count = countLeavesOfSmaller(this->root,right.root,isLeftSmaller);
+		right.mSize = isLeftSmaller ? this->mSize - count : count;
+		this->mSize -= right.mSize;
+		rebuildLeftSpine(0);
+		right.rebuildLeftSpine(0);
+	}
+	//! Function to remove all the elements no greater than data (bulk expiry), returns how many were removed
+	/*! if pRemoved is not NULL and some elements are removed, it receives their aggregate
+		(i.e., what the root of a tree of them would keep). O(log n + number of removed elements)
+	*/
+	size_t removeLeavesNotAfter(T& data,T* pRemoved = NULL)
+	{
+		if (mLeftSpine.empty() || this->Less(data,mLeftSpine.back()->data)) return 0;
+		if (!Augment::IS_LEAF_ORIENTED)
+			throw new std::runtime_error("Bulk removal is only supported by leaf-oriented trees");
+		node<T,Links>* left = NULL;
+		node<T,Links>* right = NULL;
+		split(this->root,data,left,right);
+		this->root = right;
+		if (pRemoved != NULL)
+			*pRemoved = left->data;
+		size_t count = 0;
+		freeSubtree(left,count);
+		this->mSize -= count;
+		rebuildLeftSpine(0);
+		return count;
+	}
+	//! minimum batch size for which the union forks a thread
+	static const size_t UNION_PARALLEL_GRAIN = 4096;
+	//! Function to insert the sorted elements data[0..m-1] at once (join-based union), merging equal keys
+	/*! O(m log(n / m + 1)) work. The two halves of the union are computed by two threads
+		for the first levels of the recursion, up to threadNum threads (0 means one per 
+		hardware thread), as long as the batch of a half is large enough. The internal
+		nodes replaced by the union are collected by every thread on its own, and freed
+		(or retired, see setRetiredNodes()) by the calling thread at the end. Only for
+		leaf-oriented trees.
+	*/
+	void unionSorted(const T* data,size_t m,unsigned threadNum = 1)
+	{
+		if (!Augment::IS_LEAF_ORIENTED)
+			throw new std::runtime_error("Union is only supported by leaf-oriented trees");
+		if (m == 0) return;
+		//! merge the elements of the same key in the batch first
+		std::vector<T> batch;
+		batch.reserve(m);
+		for (size_t i = 0;i < m;++ i)
+		{
+			if (!batch.empty() && !this->Less(batch.back(),data[i]))
+			{
+				assert(!this->Less(data[i],batch.back()));
+				Augment::merge(batch.back(),data[i]);
 			}
 			else
-			{// right-heavy
-				current->left = left_rotate(current->left);
-				return right_rotate(current);
-			}
-
+				batch.push_back(data[i]);
 		}
-		else if (balance < - 1)
-		{// right-heavy
-			if (heightDif(current->right) <= 0)
-			{// right-heavy or balance
-				return left_rotate(current);
-			}
-			else
-			{// left-heavy
-				current->right = right_rotate(current->right);
-				return left_rotate(current);
-			}
+		if (threadNum == 0)
+			threadNum = std::max(1u,std::thread::hardware_concurrency());
+		int forkDepth = 0;
+		while ((1u << forkDepth) < threadNum)
+			++ forkDepth;
+		size_t added = 0;
+		std::vector<node<T,Links>*> replaced;
+		this->root = unionSorted(this->root,batch.data(),0,batch.size(),forkDepth,added,replaced);
+		for (auto pNode: replaced)
+			freeNode(pNode);
+		this->mSize += added;
+		rebuildLeftSpine(0);
+	}
+	//! Function to insert the sorted elements data[lo..hi-1] of distinct keys in the subtree rooted at current, returns the root of the result
+	/*! added receives the number of new leaves, and replaced the internal nodes which are
+		not part of the result any more
+	*/
+	node<T,Links>* unionSorted(node<T,Links>* current,const T* data,size_t lo,size_t hi,int forkDepth,size_t& added,std::vector<node<T,Links>*>& replaced)
+	{
+		if (lo == hi) return current;
+		if (current == NULL)
+		{
+			added += hi - lo;
+			return buildFromSortedLeaves(data,lo,hi);
 		}
-        return current;
-
-
+		if (IsLeaf(current))
+		{//! the elements smaller than the leaf go to its left, the others to its right
+			auto less = this->Less;
+			size_t i = std::lower_bound(data + lo,data + hi,current->data,less) - data, j = i;
+			if (j < hi && !this->Less(current->data,data[j]))
+				Augment::merge(current->data,data[j ++]);
+			added += (hi - lo) - (j - i);
+			node<T,Links>* left = i > lo ? buildFromSortedLeaves(data,lo,i) : NULL;
+			node<T,Links>* right = j < hi ? buildFromSortedLeaves(data,j,hi) : NULL;
+			return join(join(left,current),right);
+		}
+		//! the key of an internal node is the maximum of its subtree, hence split the batch at the one of the left subtree
+		auto less = this->Less;
+		size_t mid = std::upper_bound(data + lo,data + hi,current->left->data,less) - data;
+		node<T,Links>* leftChild = current->left;
+		node<T,Links>* rightChild = current->right;
+		replaced.push_back(current);
+		size_t addedLeft = 0, addedRight = 0;
+		if (forkDepth > 0 && std::min(mid - lo,hi - mid) >= UNION_PARALLEL_GRAIN)
+		{
+			std::vector<node<T,Links>*> replacedLeft;
+			std::thread worker([&]{ leftChild = unionSorted(leftChild,data,lo,mid,forkDepth - 1,addedLeft,replacedLeft); });
+			rightChild = unionSorted(rightChild,data,mid,hi,forkDepth - 1,addedRight,replaced);
+			worker.join();
+			replaced.insert(replaced.end(),replacedLeft.begin(),replacedLeft.end());
+		}
+		else
+		{
+			leftChild = unionSorted(leftChild,data,lo,mid,0,addedLeft,replaced);
+			rightChild = unionSorted(rightChild,data,mid,hi,0,addedRight,replaced);
+		}
+		added += addedLeft + addedRight;
+		return join(leftChild,rightChild);
 	}
-#endif
-	//! A function to remove element data from the subtree rooted at current, perform rotation if necessary
-	node<T>* remove(node<T>* current,T& data)
+	//! Function to join the subtrees left and right (all the leaves of left first), returns the root of the result
+	node<T,Links>* join(node<T,Links>* left,node<T,Links>* right)
+	{
+		if (left == NULL) return right;
+		if (right == NULL) return left;
+		//! descend along the inner spine of the taller subtree down to a height close to the other one
+		if (height(left) > height(right) + 1)
+		{
+			left->right = join(left->right,right);
+			left->height = std::max(height(left->left),height(left->right)) + 1;
+			updateAugmentedMembers(left);
+			return rebalance(left);
+		}
+		if (height(right) > height(left) + 1)
+		{
+			right->left = join(left,right->left);
+			right->height = std::max(height(right->left),height(right->right)) + 1;
+			updateAugmentedMembers(right);
+			return rebalance(right);
+		}
+		node<T,Links>* current = new node<T,Links>(right->data);
+		current->left = left;
+		current->right = right;
+		current->height = std::max(height(left),height(right)) + 1;
+		updateAugmentedMembers(current);
+		return current;
+	}
+	//! Function to split the subtree rooted at current into the leaves no greater than data (left) and the others (right)
+	/*! the internal nodes on the search path of data are freed, and the subtrees hanging
+		from it are joined back, which costs O(log n) in total
+	*/
+	void split(node<T,Links>* current,T& data,node<T,Links>*& left,node<T,Links>*& right)
 	{
 		if (current == NULL)
-			throw new std::runtime_error("Cannot remove non-exist element");
-
-		if (data == current->data)
 		{
-			if (!current->left)
-				return remove(current->right,data);
-			else if (!current->right)
-				return remove(current->left,data);
+			left = right = NULL;
+			return;
+		}
+		if (IsLeaf(current))
+		{
+			if (this->Less(data,current->data))
+			{
+				left = NULL;
+				right = current;
+			}
 			else
 			{
-				current->data = retrievalData(current->left);
-				current->left = remove(current->left,current->data);
+				left = current;
+				right = NULL;
 			}
+			return;
 		}
-
-		if (current == NULL) return current;
-
-		current->height = std::max(height(current->left),height(current->right)) + 1;
-
-		int balance = heightDif(current);
-
-#ifdef AUGMENTED_L_GPS
-
-		updateAugmentedMembers(current);
-		updateAugmentedMembers(right);
-
-#endif
-
-		if (balance > 1)
-		{// left-heavy
-			if (heightDif(current->left) >= 0)
-			{// left-heavy or balance
-				return right_rotate(current);
+		node<T,Links>* leftChild = current->left;
+		node<T,Links>* rightChild = current->right;
+		freeNode(current);
+		node<T,Links>* middle = NULL;
+		//! the key of an internal node is the maximum of its subtree, hence compare with the left subtree
+		if (this->Less(data,leftChild->data))
+		{
+			split(leftChild,data,left,middle);
+			right = join(middle,rightChild);
+		}
+		else
+		{
+			split(rightChild,data,middle,right);
+			left = join(leftChild,middle);
+		}
+	}
+	//! Function to count the leaves of the smaller of the subtrees a and b, visiting both alternately
+	size_t countLeavesOfSmaller(node<T,Links>* a,node<T,Links>* b,bool& isASmaller)
+	{
+		std::vector<node<T,Links>*> stacks[2];
+		size_t counts[2] = {0,0};
+		if (a != NULL) stacks[0].push_back(a);
+		if (b != NULL) stacks[1].push_back(b);
+		for (int turn = 0;;turn ^= 1)
+		{
+			if (stacks[turn].empty())
+			{
+				isASmaller = (turn == 0);
+				return counts[turn];
 			}
+			node<T,Links>* current = stacks[turn].back();
+			stacks[turn].pop_back();
+			if (IsLeaf(current))
+				++ counts[turn];
 			else
-			{// right-heavy
-				current->left = left_rotate(current->left);
-				return right_rotate(current);
+			{
+				stacks[turn].push_back(current->left);
+				stacks[turn].push_back(current->right);
 			}
+		}
+	}
+	//! Function to free the subtree rooted at current, count receives the number of its leaves
+	void freeSubtree(node<T,Links>* current,size_t& count)
+	{
+		if (current == NULL) return;
+		if (IsLeaf(current))
+			++ count;
+		freeSubtree(current->left,count);
+		freeSubtree(current->right,count);
+		freeNode(current);
+	}
+	//! Function to remove the leftmost leaf in the tree if it is no greater than data
+	/*! if the leaf is removed, data receives its content, and its parent is replaced by
+		its sibling (i.e., the right child of its parent).
+		The check uses the cached leftmost leaf, hence it costs O(1) when nothing is removed.
+	*/
+	bool removeLeftmostLeafIfNecessary(T& data)
+	{
+		if (mLeftSpine.empty() || this->Less(data,mLeftSpine.back()->data)) return false;
+		//! the left spine is the path to the leftmost leaf
+		node<T,Links>** path = mLeftSpine.data();
+		int depth = (int)mLeftSpine.size() - 1;
+		node<T,Links>* current = mLeftSpine.back();
+		data = current->data;
+		-- this->mSize;
+		freeNode(current);
+		if (depth == 0)
+		{
+			this->root = NULL;
+			mLeftSpine.clear();
+			return true;
+		}
+		//! replace the parent of the leaf by its sibling
+		node<T,Links>* parent = path[-- depth];
+		assert(parent->right != NULL);
+		if (depth == 0)
+			this->root = parent->right;
+		else
+			path[depth - 1]->left = parent->right;
+		freeNode(parent);
+		//! the sibling and its left spine take the place of the parent and the leaf on the spine
+		int rotated = fixPath(path,depth);
+		rebuildLeftSpine(std::min(rotated,depth));
+		return true;
+	}
+	//! A function to remove element data from the subtree rooted at current, perform rotation if necessary
+	node<T,Links>* remove(node<T,Links>* current,T& data)
+	{
+		if (current == NULL)
+			throw new std::runtime_error("Cannot remove non-exist element");
 
+		if (this->Less(data,current->data))
+			current->left = remove(current->left,data);
+		else if (this->Less(current->data,data))
+			current->right = remove(current->right,data);
+		else if (current->left == NULL || current->right == NULL)
+		{//! replace the node by its only child (if any)
+			node<T,Links>* child = current->left != NULL ? current->left : current->right;
+			data = current->data;
+			freeNode(current);
+			return child;
 		}
-		else if (balance < - 1)
-		{// right-heavy
-			if (heightDif(current->right) <= 0)
-			{// right-heavy or balance
-				return left_rotate(current);
-			}
-			else
-			{// left-heavy
-				current->right = right_rotate(current->right);
-				return left_rotate(current);
-			}
+		else
+		{//! replace the element by its predecessor, which is then removed from the left subtree
+			T removed = current->data;
+			current->data = this->retrievalData(current->left);
+			current->left = remove(current->left,current->data);
+			data = removed;
 		}
-        return current;
 
+		current->height = std::max(height(current->left),height(current->right)) + 1;
+		updateAugmentedMembers(current);
+		return rebalance(current);
 	}
 	//! Function to return whether a specific node is leaf or node
-	bool IsLeaf(node<T>* current)
+	bool IsLeaf(node<T,Links>* current)
 	{
 		return (current->left == NULL && current->right == NULL);
 	}
-	node<T>* GetRoot()
+	node<T,Links>* GetRoot()
 	{
 		return this->root;
 	}
@@ -338,7 +891,7 @@ public:
 		if (this->empty()) return true;
 		return IsAVLTree(this->root);
 	}
-	bool IsAVLTree(node<T>* current)
+	bool IsAVLTree(node<T,Links>* current)
 	{
 		if (current == NULL) return true;
 		if (abs(heightDif(current)) > 1) return false;
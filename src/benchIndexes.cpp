@@ -0,0 +1,136 @@
+/*
+	Benchmark of the break point indexes of L-GPS (see L_GPS_Indexes.hpp).
+
+	The packets of a trace (or of a random workload: Poisson arrivals at 98% load from
+	flows of random weights) are fed to L_GPSGenericSim on every index, and the time per
+	packet, the largest number of break points and the largest difference between the
+	virtual finish times and the ones of L_GPSSim are reported.
+
+	usage: benchIndexes [<trace file>]
+	       benchIndexes -r [<packet number> [<flow number>]]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "L_GPS_GenericSim.hpp"
+#include "traceReader.hpp"
+
+//! function to run a simulator on all the packets, returns the time per packet in ns
+template <class Sim>
+double runSimulator(Sim& sim,std::vector<Packet *>& packets,std::vector<double>& flowWeights,std::vector<double>& finishTimes,size_t& maxSize)
+{
+	std::vector<double> flowLastDepartVTimes(flowWeights.size(),0.0);
+	finishTimes.resize(packets.size());
+	maxSize = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0;i < packets.size();++ i)
+	{
+		int flow = packets[i]->mFlowId - 1;
+		finishTimes[i] = sim.HandleNewPacketArrival(packets[i],flowWeights[flow],flowLastDepartVTimes[flow]);
+		if ((i & 1023) == 0)
+			maxSize = std::max(maxSize,(size_t)sim.GetIndex().size());
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double,std::nano>(end - begin).count() / std::max<size_t>(1,packets.size());
+}
+
+//! function to print the measures of an index
+void report(const char* name,double ns,size_t maxSize,std::vector<double>& finishTimes,std::vector<double>& reference)
+{
+	double maxError = 0;
+	for (size_t i = 0;i < finishTimes.size();++ i)
+		maxError = std::max(maxError,std::fabs(finishTimes[i] - reference[i]) / std::max(1.0,std::fabs(reference[i])));
+	std::cout << std::left << std::setw(12) << name << std::setw(16) << std::fixed << std::setprecision(1) << ns
+			  << std::setw(20) << maxSize << std::scientific << std::setprecision(2) << maxError << std::endl;
+}
+
+//! adapter giving L_GPSSim the interface of L_GPSGenericSim used by runSimulator()
+class L_GPSSimAdapter{
+	L_GPSSim mSim;
+public:
+	double HandleNewPacketArrival(Packet* pPKT,double flowWeight,double& flowLastDepartVTime)
+	{
+		return mSim.HandleNewPacketArrival(pPKT,flowWeight,flowLastDepartVTime);
+	}
+	BreakPointTree& GetIndex()
+	{
+		return *mSim.GetAVLTree();
+	}
+};
+
+int main(int argc,char* argv[])
+{
+	std::vector<Packet *> packets;
+	std::vector<double> flowWeights;
+	try{
+		if (argc > 1 && std::string(argv[1]) != "-r")
+		{
+			TraceReader reader(argv[1]);
+			flowWeights = reader.GetFlowWeights();
+			reader.readAllParallel(packets,0,true);
+		}
+		else
+		{
+			size_t packetNum = argc > 2 ? std::strtoul(argv[2],NULL,10) : 1000000;
+			size_t flowNum = argc > 3 ? std::strtoul(argv[3],NULL,10) : 1000;
+			std::mt19937_64 rng(2007);
+			std::uniform_real_distribution<double> weightDist(0.5,4.0);
+			std::uniform_int_distribution<int> lengthDist(64,1500);
+			std::uniform_int_distribution<int> flowDist(1,(int)flowNum);
+			std::exponential_distribution<double> gapDist(0.98 / 782.0);
+			for (size_t f = 0;f < flowNum;++ f)
+				flowWeights.push_back(weightDist(rng));
+			double time = 0;
+			for (size_t i = 0;i < packetNum;++ i)
+			{
+				time += gapDist(rng);
+				packets.push_back(new Packet(flowDist(rng),i + 1,lengthDist(rng),(long int)time));
+			}
+		}
+	}
+	catch(std::runtime_error* e)
+	{
+		std::cout << "Cannot load the packets: " << e->what() << std::endl;
+		return 1;
+	}
+
+	std::vector<double> reference, finishTimes;
+	size_t maxSize;
+	std::cout << "packets: " << packets.size() << ", flows: " << flowWeights.size() << std::endl;
+	std::cout << std::left << std::setw(12) << "index" << std::setw(16) << "ns/packet" << std::setw(20) << "max break points" << "max rel. error" << std::endl;
+	{
+		L_GPSSimAdapter sim;
+		double ns = runSimulator(sim,packets,flowWeights,reference,maxSize);
+		report("L_GPSSim",ns,maxSize,reference,reference);
+	}
+	{
+		L_GPSGenericSim<AVLBreakPointIndex> sim;
+		double ns = runSimulator(sim,packets,flowWeights,finishTimes,maxSize);
+		report("AVL",ns,maxSize,finishTimes,reference);
+	}
+	{
+		L_GPSGenericSim<RBBreakPointIndex> sim;
+		double ns = runSimulator(sim,packets,flowWeights,finishTimes,maxSize);
+		report("red-black",ns,maxSize,finishTimes,reference);
+	}
+	{
+		L_GPSGenericSim<TreapBreakPointIndex> sim;
+		double ns = runSimulator(sim,packets,flowWeights,finishTimes,maxSize);
+		report("treap",ns,maxSize,finishTimes,reference);
+	}
+	{
+		L_GPSGenericSim<SkipListBreakPointIndex> sim;
+		double ns = runSimulator(sim,packets,flowWeights,finishTimes,maxSize);
+		report("skip list",ns,maxSize,finishTimes,reference);
+	}
+	for (auto pPKT: packets)
+		delete pPKT;
+	return 0;
+}
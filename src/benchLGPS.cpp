@@ -0,0 +1,169 @@
+/*
+	Benchmark of the descent kernels of L_GPSSim on a random workload.
+
+	A simulator is loaded with one packet of random length from each of n flows of
+	random weights (i.e., n + 1 break points), and m random real times within the
+	busy period are converted to virtual times by every kernel, one query at a time
+	and in lockstep batches. The time per query and, on Linux (if perf events are
+	allowed), the branch misses per query are reported.
+
+	usage: benchLGPS [<break point number> [<query number>]]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "L_GPSsim.hpp"
+
+//! class to count the branch misses of the calling thread
+class BranchMissCounter{
+	int mFd;
+public:
+	BranchMissCounter()
+	{
+		mFd = -1;
+#ifdef __linux__
+		struct perf_event_attr attr;
+		std::memset(&attr,0,sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		mFd = syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+#endif
+	}
+	~BranchMissCounter()
+	{
+#ifdef __linux__
+		if (mFd >= 0) close(mFd);
+#endif
+	}
+	//! whether the counter is available
+	bool available()
+	{
+		return mFd >= 0;
+	}
+	void start()
+	{
+#ifdef __linux__
+		if (mFd < 0) return;
+		ioctl(mFd,PERF_EVENT_IOC_RESET,0);
+		ioctl(mFd,PERF_EVENT_IOC_ENABLE,0);
+#endif
+	}
+	//! function to stop counting, returns the number of branch misses since start()
+	long long stop()
+	{
+		long long count = 0;
+#ifdef __linux__
+		if (mFd < 0) return -1;
+		ioctl(mFd,PERF_EVENT_IOC_DISABLE,0);
+		if (read(mFd,&count,sizeof(count)) != sizeof(count)) return -1;
+#endif
+		return count;
+	}
+};
+
+int main(int argc,char* argv[])
+{
+	size_t breakPointNum = argc > 1 ? std::strtoul(argv[1],NULL,10) : 1000000;
+	size_t queryNum = argc > 2 ? std::strtoul(argv[2],NULL,10) : 4000000;
+	if (breakPointNum == 0 || queryNum == 0)
+	{
+		std::cout << "usage: benchLGPS [<break point number> [<query number>]]" << std::endl;
+		return 1;
+	}
+
+	std::mt19937_64 rng(2007);
+	std::uniform_real_distribution<double> weightDist(0.5,4.0);
+	std::uniform_int_distribution<int> lengthDist(64,1500);
+
+	//! every flow sends one packet at time 0
+	L_GPSSim sim;
+	double totalWork = 0;
+	for (size_t i = 0;i < breakPointNum;++ i)
+	{
+		Packet pkt(i + 1,i + 1,lengthDist(rng),0);
+		double lastDepartVTime = 0;
+		sim.HandleNewPacketArrival(&pkt,weightDist(rng),lastDepartVTime);
+		totalWork += pkt.mLength;
+	}
+	std::vector<double> queries(queryNum);
+	std::uniform_real_distribution<double> timeDist(0,totalWork);
+	for (auto& t: queries)
+		t = timeDist(rng);
+
+	struct Kernel{
+		const char *name;
+		double (L_GPSSim::*function)(double);
+	};
+	Kernel kernels[] = {
+		{"RTime2VTime",&L_GPSSim::RTime2VTime},
+		{"RTime2VTimeFinger",&L_GPSSim::RTime2VTimeFinger},
+		{"RTime2VTimeBranchless",&L_GPSSim::RTime2VTimeBranchless}
+	};
+	struct BatchKernel{
+		const char *name;
+		LockstepISA isa;
+	};
+	BatchKernel batchKernels[] = {
+		{"Lockstep (scalar)",LOCKSTEP_SCALAR},
+		{"Lockstep (SSE2)",LOCKSTEP_SSE2},
+		{"Lockstep (AVX2)",LOCKSTEP_AVX2}
+	};
+	std::vector<double> reference(queryNum), results(queryNum);
+	BranchMissCounter counter;
+	//! function to print the measures of a kernel and to check its results
+	auto report = [&](const char* name,double seconds,long long misses,bool isReference){
+		std::cout << std::left << std::setw(24) << name << std::setw(16) << std::fixed << std::setprecision(1) << seconds * 1e9 / queryNum;
+		if (counter.available() && misses >= 0)
+			std::cout << std::setprecision(2) << (double)misses / queryNum;
+		else
+			std::cout << "n/a";
+		if (isReference)
+			reference.swap(results);
+		else if (results != reference)
+			std::cout << "  (results differ from RTime2VTime)";
+		std::cout << std::endl;
+	};
+
+	std::cout << "break points: " << sim.GetAVLTree()->size() << ", queries: " << queryNum << std::endl;
+	std::cout << std::left << std::setw(24) << "kernel" << std::setw(16) << "ns/query" << "branch misses/query" << std::endl;
+	for (size_t k = 0;k < sizeof(kernels) / sizeof(kernels[0]);++ k)
+	{
+		counter.start();
+		auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0;i < queryNum;++ i)
+			results[i] = (sim.*kernels[k].function)(queries[i]);
+		auto end = std::chrono::steady_clock::now();
+		long long misses = counter.stop();
+		report(kernels[k].name,std::chrono::duration<double>(end - begin).count(),misses,k == 0);
+	}
+	for (size_t k = 0;k < sizeof(batchKernels) / sizeof(batchKernels[0]);++ k)
+	{
+		if (batchKernels[k].isa > LockstepDescent<BreakPointTreeNode>::bestISA())
+		{
+			std::cout << std::left << std::setw(24) << batchKernels[k].name << "not supported by the CPU" << std::endl;
+			continue;
+		}
+		counter.start();
+		auto begin = std::chrono::steady_clock::now();
+		sim.RTime2VTimeLockstep(queries.data(),queryNum,results.data(),batchKernels[k].isa);
+		auto end = std::chrono::steady_clock::now();
+		long long misses = counter.stop();
+		report(batchKernels[k].name,std::chrono::duration<double>(end - begin).count(),misses,false);
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+	Blocking bounded FIFO queue used to connect the stages of a pipeline.
+
+	push() blocks while the queue is full and pop() blocks while it is empty, so a
+	fast stage cannot run arbitrarily far ahead of a slow one. Once the producer
+	calls close(), pop() returns false after the remaining elements are drained.
+*/
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+//! class for a blocking bounded queue
+template <class T>
+class BoundedQueue{
+	//! elements in the queue
+	std::queue<T> mItems;
+	//! maximum number of elements
+	size_t mCapacity;
+	//! set when no more element will be pushed
+	bool mClosed;
+	std::mutex mLock;
+	std::condition_variable mNotFull;
+	std::condition_variable mNotEmpty;
+public:
+	//! constructor
+	explicit BoundedQueue(size_t capacity)
+	{
+		mCapacity = capacity > 0 ? capacity : 1;
+		mClosed = false;
+	}
+	//! function to append an element, returns false if the queue is closed
+	bool push(T data)
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mNotFull.wait(lock,[this]{ return mClosed || mItems.size() < mCapacity; });
+		if (mClosed) return false;
+		mItems.push(std::move(data));
+		mNotEmpty.notify_one();
+		return true;
+	}
+	//! function to remove the oldest element, returns false if the queue is closed and empty
+	bool pop(T& data)
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mNotEmpty.wait(lock,[this]{ return mClosed || !mItems.empty(); });
+		if (mItems.empty()) return false;
+		data = std::move(mItems.front());
+		mItems.pop();
+		mNotFull.notify_one();
+		return true;
+	}
+	//! function to close the queue
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		mClosed = true;
+		mNotFull.notify_all();
+		mNotEmpty.notify_all();
+	}
+};
+
+#endif
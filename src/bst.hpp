@@ -14,20 +14,66 @@
 #include <queue>
 #include <unordered_map>
 #include <functional> // for less
+#include <atomic>
 #include <stdexcept> // for run time error
 #include <cassert>
 
 
+//! Link to a node, which may be followed by concurrent readers while the tree is updated
+/*! it is used as a plain pointer, but it is stored with release semantics and loaded
+	with acquire semantics, so that a reader following a link sees the node as it was
+	initialized before it was linked (e.g., see L_GPSSimReader). On x86 both compile to
+	plain moves. A tree uses it through the PublishedLinks policy.
+*/
+template <class N>
+class NodeLink{
+	std::atomic<N*> mpNode;
+public:
+	NodeLink(N* pNode = NULL):mpNode(pNode){}
+	NodeLink(const NodeLink& other):mpNode((N*)other){}
+	NodeLink& operator=(N* pNode)
+	{
+		mpNode.store(pNode,std::memory_order_release);
+		return *this;
+	}
+	NodeLink& operator=(const NodeLink& other)
+	{
+		return *this = (N*)other;
+	}
+	operator N*() const
+	{
+		return mpNode.load(std::memory_order_acquire);
+	}
+	N* operator->() const
+	{
+		return mpNode.load(std::memory_order_acquire);
+	}
+};
+
+//! link policy of the trees which are only accessed by one thread at a time (the default), links are plain pointers
+struct PlainLinks{
+	template <class N>
+	using Link = N*;
+};
+
+//! link policy of the trees which are read by concurrent readers while they are updated, links are NodeLink
+struct PublishedLinks{
+	template <class N>
+	using Link = NodeLink<N>;
+};
+
 //! The data structure for each node in the binary search tree
-template <class T>
+/*! Links is the link policy (PlainLinks or PublishedLinks) of the tree of the node
+*/
+template <class T,class Links = PlainLinks>
 class node{
 public:
 	//! data field
 	T data; 
 	//! left child
-	node *left;
+	typename Links::template Link<node> left;
 	//! right child
-	node *right;
+	typename Links::template Link<node> right;
 #ifdef AVL_TREE_HPP
 	//! the height of this node in the AVL tree
 	int height;
@@ -50,36 +96,37 @@ public:
  	Generic binary search tree.
 	Can be used with an customized comparator instead of the natural order,
 	but the generic Value type must still be comparable.
+	Links is the link policy (see PlainLinks).
 */
-template <class T,class Compare=std::less<T> >
+template <class T,class Compare=std::less<T>,class Links = PlainLinks>
 class BST{
 protected:
 	//! node in BST
-	node<T> *root;
+	typename Links::template Link<node<T,Links> > root;
 	//! comparison function
 	Compare Less;
 	//! number of nodes
 	int mSize;
 	//! A function to insert an element into the subtree rooted at current
-	void insert(node<T> *current,T& data)
+	void insert(node<T,Links> *current,T& data)
 	{
         if (Less(current->data,data))
         	{
         		if (current->right == NULL)
-        			current->right = new node<T>(data);
+        			current->right = new node<T,Links>(data);
         		else
         			insert(current->right,data);
         	}
         else
         {
         	if (current->left == NULL)
-        		current->left = new node<T>(data);
+        		current->left = new node<T,Links>(data);
         	else
         		insert(current->left,data);
         }
 	}
 	//! A function to check whether the element toSearch is in the subtree rooted at current or not
-	node<T>* contains(node<T> *current,T& toSearch)
+	node<T,Links>* contains(node<T,Links> *current,T& toSearch)
 	{
 		if (current == NULL) return NULL;
 		if (current->data == toSearch) return current;
@@ -87,7 +134,7 @@ protected:
 		else return contains(current->right,toSearch);
 	}
 	//! A function to remove the element toRemove from the subtree rooted at current
-	node<T>* remove(node<T> *current,T& toRemove)
+	node<T,Links>* remove(node<T,Links> *current,T& toRemove)
 	{
 		if (current == NULL) throw new std::runtime_error("The element does not exists!");
         if (current->data == toRemove)
@@ -110,14 +157,14 @@ protected:
         return current;
 	}
 	//! A function to retrieve the next element of the current node
-	T retrievalData(node<T> *current)
+	T retrievalData(node<T,Links> *current)
 	{
 		if (current == NULL) throw new std::runtime_error("Cannot retrieval data from an empty node");
 		while (current->right) current = current->right;
 		return current->data;
 	}
 	//! A recursive function to postorder traverse the subtree rooted at current 
-	void explore(node<T> *current,bool saveFlag,std::vector<T>& savedElements)
+	void explore(node<T,Links> *current,bool saveFlag,std::vector<T>& savedElements)
 	{
 		if (current == NULL) return;
 		explore(current->left,saveFlag,savedElements);
@@ -158,7 +205,7 @@ public:
 	void insert(T& data)
 	{
         if (root == NULL)
-        	root = new node<T>(data);
+        	root = new node<T,Links>(data);
         else
         	insert(root,data);
 		++ mSize;
@@ -194,7 +241,7 @@ public:
 	/*!
 	Note that, the height of any leaf node is 0.
 	*/
-	int height(node<T> *current)
+	int height(node<T,Links> *current)
 	{
 		if (current == NULL) return -1;
 		return std::max(height(current->left),height(current->right)) + 1;
@@ -211,7 +258,7 @@ public:
 		return maxWid;
 	}
     //! A function to obtain  number of node on a given level
-	int width(node<T> *current,int depth)
+	int width(node<T,Links> *current,int depth)
 	{
 		if (current == NULL) return 0;
 		else if (depth == 0) return 1;
@@ -226,7 +273,7 @@ public:
 		return diameter(root);
 	}
     //! A function to obtain the diameter of the subtree rooted at current
-	int diameter(node<T> *current)
+	int diameter(node<T,Links> *current)
 	{
 		if (current == NULL) return 0;
 
@@ -242,7 +289,7 @@ public:
 		return max(root);
 	}
     //! A function to obtain the maximum element in the subtree rooted at current
-	T max(node<T> *current)
+	T max(node<T,Links> *current)
 	{
 		if (current == NULL) throw new std::runtime_error("Cannot obtain maximum element from an empty subtree");
 		if (current->right) return max(current->right);
@@ -254,7 +301,7 @@ public:
 		return min(root);
 	}
     //! A function to obtain the minimum element in the subtree rooted at current
-	T min(node<T> *current)
+	T min(node<T,Links> *current)
 	{
 		if (current == NULL) throw new std::runtime_error("Cannot obtain minimum element from an empty subtree");
 		if (current->left) return min(current->left);
@@ -263,7 +310,7 @@ public:
 	//! A function to query the next element of data, i.e., the smallest element that is larger than data
 	T next(T& data)
 	{
- 		node<T>* current = contains(root,data);
+ 		node<T,Links>* current = contains(root,data);
  		if (current == NULL) throw new std::runtime_error("Cannot obtain the next element for a non-exist element");
  		if (current->right)
  		{
@@ -275,7 +322,7 @@ public:
 	//! A function to query the previous element of data, i.e., the largest element that is smaller than data
 	T previous(T& data)
 	{
-		node<T>* current = contains(root,data);
+		node<T,Links>* current = contains(root,data);
  		if (current == NULL) throw new std::runtime_error("Cannot obtain the previous element for a non-exist element");
  		if (current->left)
  		{
@@ -296,13 +343,14 @@ public:
     {
     	std::vector<T> myVec;
     	explore(root,true,myVec);
+    	return myVec;
     }
     //! function to perform BFS on the binary search tree
     void bfs(std::vector<T>& dataBFSOrder,std::vector<int>& parents,std::vector<int>& leftOrRight)
     {
     	 if (empty()) return;
-    	 std::unordered_map<node<T>*,int> node2Index;
-         std::queue<node<T>*> Q;
+    	 std::unordered_map<node<T,Links>*,int> node2Index;
+         std::queue<node<T,Links>*> Q;
 
          int nodeIndex = 0;
          Q.push(root);
@@ -340,6 +388,21 @@ public:
 	{
 		return mSize;
 	}
+	//! A function to remove all the elements
+	void clear()
+	{
+		clear(root);
+		root = NULL;
+		mSize = 0;
+	}
+	//! A function to free all the nodes of the subtree rooted at current
+	void clear(node<T,Links> *current)
+	{
+		if (current == NULL) return;
+		clear(current->left);
+		clear(current->right);
+		delete current;
+	}
 
 
 };
@@ -0,0 +1,312 @@
+/*
+	External-memory sorting of packets by arrival time.
+
+	Packets are added in any order and buffered until the memory budget is used up;
+	the buffer is then sorted (by SortPacketsByArrival()) and spilled to a binary run
+	file. Once all the packets are added, the runs are k-way merged while they are
+	read back, so packets come out in arrival order with at most the memory budget
+	(shared by the read buffers of the runs) in use. If everything fits in the budget,
+	no file is written at all.
+	At most maxFanIn runs are open at the same time, which bounds the number of file
+	descriptors: while there are more runs, groups of maxFanIn consecutive runs are
+	merged into new run files, in as many passes as needed.
+	Like SortPacketsByArrival(), the order is stable: runs are spilled in input order,
+	consecutive runs are merged in order, and ties between runs are broken by run
+	index.
+	The run files are named after the process ID and a random number drawn by every
+	sorter, so that sorters of different processes can share the spill directory.
+*/
+#ifndef EXTERNAL_SORT_HPP
+#define EXTERNAL_SORT_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream> // for ostringstream
+#include <queue> // for priority_queue
+#include <functional> // for greater
+#include <cstdio> // for remove
+#include <algorithm> // for min & max
+#include <stdexcept> // for runtime_error
+#include <random>
+#include <chrono>
+#ifdef _WIN32
+#include <process.h> // for _getpid
+#else
+#include <unistd.h> // for getpid
+#endif
+
+#include "packet.hpp"
+#include "arrivalSort.hpp"
+
+//! class for the external merge sort of packets by arrival time
+class ExternalArrivalSorter{
+	//! on-disk record of a packet
+	struct PacketRecord{
+		long long arrivalTime;
+		int flowId;
+		int packetId;
+		int length;
+		int portId;
+	};
+	//! reader of one spilled run
+	struct RunReader{
+		std::ifstream mFile;
+		std::vector<PacketRecord> mBuffer;
+		size_t mPos;
+		size_t mSize;
+		//! function to refill the buffer, returns false at the end of the run
+		bool refill()
+		{
+			mFile.read((char *)mBuffer.data(),mBuffer.size() * sizeof(PacketRecord));
+			mSize = mFile.gcount() / sizeof(PacketRecord);
+			mPos = 0;
+			return mSize > 0;
+		}
+	};
+	//! approximate memory used per buffered packet: the packet, its pointer and the radix sort buffers
+	static const size_t BYTES_PER_PACKET = sizeof(Packet) + sizeof(Packet *) + 4 * sizeof(void *);
+
+	//! directory and common part of the names of the run files
+	std::string mSpillDir;
+	std::string mRunPrefix;
+	//! maximum number of packets buffered in memory
+	size_t mMaxBuffered;
+	//! number of threads used to sort a run
+	unsigned mThreadNum;
+	//! maximum number of runs merged at the same time
+	size_t mMaxFanIn;
+	//! number of run files created so far (used to name them)
+	size_t mRunFileNum;
+	//! number of runs spilled from memory
+	size_t mSpilledRunNum;
+	//! number of merge passes writing intermediate runs
+	size_t mMergePassNum;
+	//! packets added but not spilled yet (or all the packets if nothing was spilled)
+	std::vector<Packet *> mBuffer;
+	//! position of next() in mBuffer when nothing was spilled
+	size_t mBufferPos;
+	//! paths of the run files which are not merged yet, in input order
+	std::vector<std::string> mRunPaths;
+	//! readers of the runs being merged
+	std::vector<RunReader *> mReaders;
+	//! heads of the runs, ordered by (arrival time, run index)
+	typedef std::pair<long long,size_t> Head;
+	std::priority_queue<Head,std::vector<Head>,std::greater<Head> > mHeads;
+	//! set once finish() is called
+	bool mIsFinished;
+
+	//! function to create a new run file, whose path is appended to paths
+	void createRun(std::ofstream& ofs,std::vector<std::string>& paths)
+	{
+		std::ostringstream path;
+		//! existing files (e.g. of a sorter with the same prefix) are skipped
+		while (true)
+		{
+			path.str("");
+			path << mRunPrefix << mRunFileNum ++ << ".bin";
+			std::ifstream existing(path.str());
+			if (!existing.is_open()) break;
+		}
+		ofs.open(path.str(),std::ios::out | std::ios::binary);
+		if (!ofs.is_open())
+			throw new std::runtime_error("Cannot create run file for external sort.");
+		paths.push_back(path.str());
+	}
+	//! function to sort the buffered packets and write them to a new run file
+	void spill()
+	{
+		SortPacketsByArrival(mBuffer,mThreadNum);
+		std::ofstream ofs;
+		createRun(ofs,mRunPaths);
+		++ mSpilledRunNum;
+		for (auto pPKT: mBuffer)
+		{
+			PacketRecord r;
+			r.arrivalTime = pPKT->mArrivalTime;
+			r.flowId = pPKT->mFlowId;
+			r.packetId = pPKT->mPacketId;
+			r.length = pPKT->mLength;
+			r.portId = pPKT->mPortId;
+			ofs.write((const char *)&r,sizeof(r));
+			delete pPKT;
+		}
+		if (!ofs.good())
+			throw new std::runtime_error("Cannot write run file for external sort.");
+		ofs.close();
+		mBuffer.clear();
+	}
+	//! function to open the runs [first,last) of mRunPaths for the merge
+	/*! the memory budget is shared between the read buffers of the runs
+	*/
+	void openRuns(size_t first,size_t last)
+	{
+		size_t recordsPerRun = std::max<size_t>(1,mMaxBuffered * BYTES_PER_PACKET / sizeof(PacketRecord) / (last - first));
+		for (size_t i = first;i < last;++ i)
+		{
+			RunReader *r = new RunReader();
+			mReaders.push_back(r);
+			r->mFile.open(mRunPaths[i],std::ios::in | std::ios::binary);
+			if (!r->mFile.is_open())
+				throw new std::runtime_error("Cannot open run file for external sort.");
+			r->mBuffer.resize(recordsPerRun);
+			if (r->refill())
+				mHeads.push(Head(r->mBuffer[0].arrivalTime,mReaders.size() - 1));
+		}
+	}
+	//! function to close the open runs
+	void closeRuns()
+	{
+		for (auto r: mReaders)
+			delete r;
+		mReaders.clear();
+		while (!mHeads.empty())
+			mHeads.pop();
+	}
+	//! function to get the next record of the open runs, returns false when they are exhausted
+	bool nextRecord(PacketRecord& rec)
+	{
+		if (mHeads.empty()) return false;
+		size_t i = mHeads.top().second;
+		mHeads.pop();
+		RunReader *r = mReaders[i];
+		rec = r->mBuffer[r->mPos ++];
+		if (r->mPos < r->mSize || r->refill())
+			mHeads.push(Head(r->mBuffer[r->mPos].arrivalTime,i));
+		return true;
+	}
+	//! function to merge groups of mMaxFanIn consecutive runs into new runs
+	void mergePass()
+	{
+		std::vector<std::string> mergedPaths;
+		try
+		{
+			for (size_t first = 0;first < mRunPaths.size();first += mMaxFanIn)
+			{
+				size_t last = std::min(first + mMaxFanIn,mRunPaths.size());
+				if (last - first == 1)
+				{//! a single run is kept as is
+					mergedPaths.push_back(mRunPaths[first]);
+					continue;
+				}
+				std::ofstream ofs;
+				createRun(ofs,mergedPaths);
+				openRuns(first,last);
+				PacketRecord rec;
+				while (nextRecord(rec))
+					ofs.write((const char *)&rec,sizeof(rec));
+				closeRuns();
+				if (!ofs.good())
+					throw new std::runtime_error("Cannot write run file for external sort.");
+				ofs.close();
+				for (size_t i = first;i < last;++ i)
+				{
+					std::remove(mRunPaths[i].c_str());
+					mRunPaths[i].clear();
+				}
+			}
+		}
+		catch (...)
+		{//! the runs not merged yet are removed by the destructor
+			closeRuns();
+			for (auto& path: mergedPaths)
+				std::remove(path.c_str());
+			throw;
+		}
+		mRunPaths.swap(mergedPaths);
+		++ mMergePassNum;
+	}
+public:
+	//! constructor
+	/*! memoryBudget is the number of bytes used to buffer packets, the run files are
+		created in spillDir, and at most maxFanIn (at least 2) of them are open at the
+		same time
+	*/
+	ExternalArrivalSorter(size_t memoryBudget,std::string spillDir = ".",unsigned threadNum = 1,size_t maxFanIn = 64)
+	{
+		mSpillDir = spillDir;
+#ifdef _WIN32
+		long pid = _getpid();
+#else
+		long pid = getpid();
+#endif
+		std::random_device device;
+		std::mt19937_64 rng(((unsigned long long)device() << 32) ^ device() ^ std::chrono::high_resolution_clock::now().time_since_epoch().count());
+		std::ostringstream prefix;
+		prefix << mSpillDir << "/lgps_run_" << pid << "_" << std::hex << rng() << std::dec << "_";
+		mRunPrefix = prefix.str();
+		mMaxBuffered = std::max<size_t>(1,memoryBudget / BYTES_PER_PACKET);
+		mThreadNum = threadNum;
+		mMaxFanIn = std::max<size_t>(2,maxFanIn);
+		mRunFileNum = 0;
+		mSpilledRunNum = 0;
+		mMergePassNum = 0;
+		mBufferPos = 0;
+		mIsFinished = false;
+	}
+	//! destructor, removes the run files
+	~ExternalArrivalSorter()
+	{
+		for (auto pPKT: mBuffer)
+			delete pPKT;
+		closeRuns();
+		for (auto& path: mRunPaths)
+			if (!path.empty())
+				std::remove(path.c_str());
+	}
+	//! function to add a packet (the sorter takes the ownership of the packet)
+	void add(Packet *pPKT)
+	{
+		if (mIsFinished)
+			throw new std::runtime_error("Cannot add packet to a finished external sort.");
+		mBuffer.push_back(pPKT);
+		if (mBuffer.size() >= mMaxBuffered)
+			spill();
+	}
+	//! function to end the input and prepare the merge
+	void finish()
+	{
+		if (mIsFinished) return;
+		mIsFinished = true;
+		if (mRunPaths.empty())
+		{//! everything fits in memory
+			SortPacketsByArrival(mBuffer,mThreadNum);
+			return;
+		}
+		if (!mBuffer.empty())
+			spill();
+		while (mRunPaths.size() > mMaxFanIn)
+			mergePass();
+		openRuns(0,mRunPaths.size());
+	}
+	//! function to get the next packet in arrival order, returns NULL when all the packets are returned
+	/*! the caller takes the ownership of the returned packet
+	*/
+	Packet* next()
+	{
+		if (!mIsFinished)
+			finish();
+		if (mRunPaths.empty())
+		{
+			if (mBufferPos == mBuffer.size()) return NULL;
+			Packet *pPKT = mBuffer[mBufferPos];
+			mBuffer[mBufferPos ++] = NULL;
+			return pPKT;
+		}
+		PacketRecord rec;
+		if (!nextRecord(rec)) return NULL;
+		return new Packet(rec.flowId,rec.packetId,rec.length,rec.arrivalTime,rec.portId);
+	}
+	//! get the number of spilled runs
+	size_t GetRunNum()
+	{
+		return mSpilledRunNum;
+	}
+	//! get the number of merge passes writing intermediate runs
+	size_t GetMergePassNum()
+	{
+		return mMergePassNum;
+	}
+};
+
+#endif
@@ -21,18 +21,24 @@ public:
 	int mLength;
 	//! GPS virtual finish time for this packet
 	double mGPS_VFTime; 
+	//! GPS real finish time for this packet (see L_GPSDepartureEngine)
+	double mGPS_RFTime;
 	//! real arrival time of this packet
 	long int mArrivalTime;
+	//! output port (i.e., GPS server) this packet is sent to
+	int mPortId;
 	//! the flow the packet belongs to
 	Flow *mpFlow; 
 	//! constructor
-	Packet(int flowId,int pktId,int pktSize,long int arrivalTime)
+	Packet(int flowId,int pktId,int pktSize,long int arrivalTime,int portId = 0)
 	{
 		mFlowId = flowId;
 		mPacketId = pktId;
 		mLength = pktSize;
 		mArrivalTime = arrivalTime;
+		mPortId = portId;
 		mpFlow = NULL;
+		mGPS_RFTime = 0.0;
 	}
 	//! set the flow to which this packet belongs
 	void SetFlow(Flow *f)
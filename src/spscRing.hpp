@@ -0,0 +1,90 @@
+/*
+	Lock-free bounded single-producer single-consumer ring buffer.
+
+	The producer only writes mTail and the consumer only writes mHead, so both
+	sides make progress without taking any lock. The capacity is rounded up to a
+	power of two to replace modulo by a mask.
+*/
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <vector>
+#include <atomic>
+#include <cstddef> // for size_t
+
+//! class for a lock-free single-producer single-consumer ring
+template <class T>
+class SPSCRing{
+	//! slots of the ring
+	std::vector<T> mBuffer;
+	//! capacity - 1
+	size_t mMask;
+	//! next slot to read (written by the consumer only)
+	alignas(64) std::atomic<size_t> mHead;
+	//! cached value of mTail seen by the consumer
+	size_t mCachedTail;
+	//! next slot to write (written by the producer only)
+	alignas(64) std::atomic<size_t> mTail;
+	//! cached value of mHead seen by the producer
+	size_t mCachedHead;
+public:
+	//! constructor
+	explicit SPSCRing(size_t capacity = 1024)
+	{
+		size_t size = 2;
+		while (size < capacity) size <<= 1;
+		mBuffer.resize(size);
+		mMask = size - 1;
+		mHead = 0;
+		mTail = 0;
+		mCachedHead = 0;
+		mCachedTail = 0;
+	}
+	//! function to append an element (producer side), returns false if the ring is full
+	bool push(const T& data)
+	{
+		size_t tail = mTail.load(std::memory_order_relaxed);
+		if (tail - mCachedHead > mMask)
+		{
+			mCachedHead = mHead.load(std::memory_order_acquire);
+			if (tail - mCachedHead > mMask) return false;
+		}
+		mBuffer[tail & mMask] = data;
+		mTail.store(tail + 1,std::memory_order_release);
+		return true;
+	}
+	//! function to get the oldest element without removing it (consumer side)
+	/*! returns NULL if the ring is empty
+	*/
+	T* front()
+	{
+		size_t head = mHead.load(std::memory_order_relaxed);
+		if (head == mCachedTail)
+		{
+			mCachedTail = mTail.load(std::memory_order_acquire);
+			if (head == mCachedTail) return NULL;
+		}
+		return &mBuffer[head & mMask];
+	}
+	//! function to remove the oldest element (consumer side), returns false if the ring is empty
+	bool pop(T& data)
+	{
+		T *pData = front();
+		if (pData == NULL) return false;
+		data = *pData;
+		mHead.store(mHead.load(std::memory_order_relaxed) + 1,std::memory_order_release);
+		return true;
+	}
+	//! function to test whether the ring is empty (consumer side)
+	bool empty()
+	{
+		return front() == NULL;
+	}
+	//! get the capacity of the ring
+	size_t capacity()
+	{
+		return mMask + 1;
+	}
+};
+
+#endif
@@ -0,0 +1,1298 @@
+/*
+	Regression tests of the L-GPS simulators.
+
+	Random workloads (Poisson arrivals from flows of random weights, some packets
+	arriving at the same time, at loads below, close to and above the capacity) are fed
+	to the simulators, and their results are checked against a brute-force fluid GPS
+	server (FluidGPSReference), which follows the virtual clock from one arrival or flow
+	emptying to the next by scanning all the flows. Small workloads which used to break
+	the simulators are checked as well.
+	Every check prints the largest relative difference it found and whether it is
+	within the tolerance (the simulators only differ from the reference by rounding),
+	and the program returns the number of failed checks.
+
+	usage: testRegression
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <functional> // for function
+#include <fstream>
+#include <sstream>
+#include <cstdio> // for remove
+#include <cstring> // for memcmp
+
+#include "L_GPSsim.hpp"
+#include "L_HGPSsim.hpp"
+#include "L_GPS_GenericSim.hpp"
+#include "L_GPS_Persistent.hpp"
+#include "L_GPS_Ingestor.hpp"
+#include "L_GPS_Departures.hpp"
+#include "L_GPS_Network.hpp"
+#include "L_GPS_ShardedSim.hpp"
+#include "L_GPS_Tester.hpp"
+#include "externalSort.hpp"
+
+//! largest relative difference accepted between a simulator and the reference
+const double TOLERANCE = 1e-9;
+
+//! random workload
+struct Workload{
+	std::string mName;
+	std::vector<double> mFlowWeights;
+	//! packets in order of arrival time
+	std::vector<Packet *> mPackets;
+	~Workload()
+	{
+		for (auto pPKT: mPackets)
+			delete pPKT;
+	}
+};
+
+//! function to generate a workload of packetNum packets from flowNum flows at the given load
+/*! the lengths are uniform in [64,1500], and a fifth of the packets arrive at the same
+	time as the previous one
+*/
+void makeWorkload(Workload& workload,const std::string& name,unsigned seed,size_t packetNum,size_t flowNum,double load)
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> weightDist(0.5,4.0);
+	std::uniform_int_distribution<int> lengthDist(64,1500);
+	std::uniform_int_distribution<int> flowDist(1,(int)flowNum);
+	std::exponential_distribution<double> gapDist(load / 782.0);
+	std::bernoulli_distribution sameTimeDist(0.2);
+	workload.mName = name;
+	for (size_t f = 0;f < flowNum;++ f)
+		workload.mFlowWeights.push_back(weightDist(rng));
+	double time = 0;
+	for (size_t i = 0;i < packetNum;++ i)
+	{
+		//! the gaps are stretched by 1 / 0.8 so that the packets arriving at the same time do not change the load
+		if (!sameTimeDist(rng))
+			time += gapDist(rng) * 1.25;
+		workload.mPackets.push_back(new Packet(flowDist(rng),i + 1,lengthDist(rng),(long int)time));
+	}
+}
+
+//! brute-force fluid GPS server
+/*! the virtual time grows at rate capacity / (sum of the weights of the backlogged
+	flows), a flow is backlogged while the virtual finish time of its last packet is
+	ahead of the virtual time, and a packet leaves when the virtual time reaches its
+	virtual finish time. Every step scans all the flows, and the virtual clock is
+	recorded as a sequence of linear segments to find the real finish times.
+*/
+class FluidGPSReference{
+	std::vector<double> mFlowWeights;
+	std::vector<double> mFlowLastDepartVTimes;
+	double mCapacity;
+	//! amount of work served so far (real time times capacity) and virtual time
+	double mWork;
+	double mVTime;
+	//! start of every segment of the virtual clock: work, virtual time and sum of the weights (0 while idle)
+	std::vector<double> mSegmentWorks;
+	std::vector<double> mSegmentVTimes;
+	std::vector<double> mSegmentSumWeights;
+	//! function to serve until work (infinity to serve all the backlog)
+	void Serve(double work)
+	{
+		while (true)
+		{
+			double sumWeight = 0, nextVTime = std::numeric_limits<double>::infinity();
+			for (size_t f = 0;f < mFlowWeights.size();++ f)
+				if (mFlowLastDepartVTimes[f] > mVTime)
+				{
+					sumWeight += mFlowWeights[f];
+					nextVTime = std::min(nextVTime,mFlowLastDepartVTimes[f]);
+				}
+			mSegmentWorks.push_back(mWork);
+			mSegmentVTimes.push_back(mVTime);
+			mSegmentSumWeights.push_back(sumWeight);
+			if (sumWeight == 0)
+			{
+				if (work > mWork && work < std::numeric_limits<double>::infinity())
+					mWork = work;
+				return;
+			}
+			//! work at which the first backlogged flow empties
+			double nextWork = mWork + (nextVTime - mVTime) * sumWeight;
+			if (nextWork > work)
+			{
+				mVTime += (work - mWork) / sumWeight;
+				mWork = work;
+				return;
+			}
+			mWork = nextWork;
+			mVTime = nextVTime;
+		}
+	}
+public:
+	FluidGPSReference(const std::vector<double>& flowWeights,double capacity = 1.0)
+	{
+		mFlowWeights = flowWeights;
+		mFlowLastDepartVTimes.assign(flowWeights.size(),0.0);
+		mCapacity = capacity;
+		mWork = 0;
+		mVTime = 0;
+	}
+	//! function to handle the arrival of length units of work of flow flowId at real time RTime (in order of arrival), returns its virtual finish time
+	double HandleNewArrival(double RTime,double length,int flowId)
+	{
+		Serve(RTime * mCapacity);
+		double& flowLastDepartVTime = mFlowLastDepartVTimes[flowId - 1];
+		flowLastDepartVTime = std::max(mVTime,flowLastDepartVTime) + length / mFlowWeights[flowId - 1];
+		return flowLastDepartVTime;
+	}
+	double HandleNewPacketArrival(Packet* pPKT)
+	{
+		return HandleNewArrival(pPKT->mArrivalTime,pPKT->mLength,pPKT->mFlowId);
+	}
+	//! function to get the real time at which the virtual time reaches VTime, once no packet arrives any more
+	double VTime2RTime(double VTime)
+	{
+		Serve(std::numeric_limits<double>::infinity());
+		//! the first segment starting at VTime or later, the virtual time is reached at its start or in the previous segment
+		size_t i = std::lower_bound(mSegmentVTimes.begin(),mSegmentVTimes.end(),VTime) - mSegmentVTimes.begin();
+		if (i < mSegmentVTimes.size() && mSegmentVTimes[i] == VTime)
+			return mSegmentWorks[i] / mCapacity;
+		if (i == 0)
+			return 0;
+		-- i;
+		return (mSegmentWorks[i] + (VTime - mSegmentVTimes[i]) * mSegmentSumWeights[i]) / mCapacity;
+	}
+};
+
+//! function to compute the relative difference of value from reference
+double relativeError(double value,double reference)
+{
+	return std::fabs(value - reference) / std::max(1.0,std::fabs(reference));
+}
+
+//! function to print the result of a check, returns 1 if it failed
+int report(const std::string& name,const std::string& check,double maxError)
+{
+	bool isPassed = maxError <= TOLERANCE;
+	std::cout << std::left << std::setw(20) << name << std::setw(40) << check << std::scientific << std::setprecision(2)
+			  << std::setw(12) << maxError << (isPassed ? "ok" : "FAILED") << std::endl;
+	return isPassed ? 0 : 1;
+}
+int report(const Workload& workload,const std::string& check,double maxError)
+{
+	return report(workload.mName,check,maxError);
+}
+
+//! function to check the virtual finish times of a simulator (L_GPSSim, L_GPSGenericSim or L_GPSSnapshotSim) against the reference
+template <class Simulator>
+int checkFinishTimes(Workload& workload,const std::string& name)
+{
+	FluidGPSReference reference(workload.mFlowWeights);
+	Simulator sim;
+	std::vector<double> flowLastDepartVTimes(workload.mFlowWeights.size(),0.0);
+	double maxError = 0;
+	for (auto pPKT: workload.mPackets)
+	{
+		double& flowLastDepartVTime = flowLastDepartVTimes[pPKT->mFlowId - 1];
+		double VFTime = sim.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+		maxError = std::max(maxError,relativeError(VFTime,reference.HandleNewPacketArrival(pPKT)));
+	}
+	return report(workload,name + " virtual finish times",maxError);
+}
+
+//! function to check L_GPSSim restored from a checkpoint taken halfway through the workload
+/*! the virtual finish times after the restore must match the reference, and every
+	truncated copy of the checkpoint, as well as the checkpoint followed by one more byte,
+	must be rejected before the finish times of the flows are touched
+*/
+int checkCheckpoint(Workload& workload)
+{
+	FluidGPSReference reference(workload.mFlowWeights);
+	L_GPSSim saved, restored;
+	std::vector<double> flowLastDepartVTimes(workload.mFlowWeights.size(),0.0);
+	size_t half = workload.mPackets.size() / 2;
+	for (size_t i = 0;i < half;++ i)
+	{
+		Packet *pPKT = workload.mPackets[i];
+		saved.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTimes[pPKT->mFlowId - 1]);
+		reference.HandleNewPacketArrival(pPKT);
+	}
+	std::ostringstream os;
+	saved.SaveCheckpoint(os,flowLastDepartVTimes);
+	std::string checkpoint = os.str() + '\0';
+	double maxError = 0;
+	std::vector<double> restoredFlowLastDepartVTimes;
+	for (size_t size = 0;size <= checkpoint.size();++ size)
+	{
+		if (size == checkpoint.size() - 1) continue;
+		try{
+			restored.LoadCheckpoint(checkpoint.data(),size,restoredFlowLastDepartVTimes);
+			maxError = std::numeric_limits<double>::infinity();
+		}
+		catch(std::runtime_error* e)
+		{
+			delete e;
+		}
+	}
+	if (!restoredFlowLastDepartVTimes.empty())
+		maxError = std::numeric_limits<double>::infinity();
+	restored.LoadCheckpoint(checkpoint.data(),checkpoint.size() - 1,restoredFlowLastDepartVTimes);
+	for (size_t i = half;i < workload.mPackets.size();++ i)
+	{
+		Packet *pPKT = workload.mPackets[i];
+		double& flowLastDepartVTime = restoredFlowLastDepartVTimes[pPKT->mFlowId - 1];
+		double VFTime = restored.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime);
+		maxError = std::max(maxError,relativeError(VFTime,reference.HandleNewPacketArrival(pPKT)));
+	}
+	return report(workload,"checkpoint virtual finish times",maxError);
+}
+
+//! function to check the order and the virtual finish times of the packets handled by L_GPSIngestor
+/*! the flows are spread over PRODUCER_NUM producer threads, each pushing the packets of
+	its flows in arrival order, so the packets of different producers arriving at close
+	times are interleaved by the ingestor. Any packet missing or handled out of arrival
+	order fails the check.
+*/
+int checkIngestor(Workload& workload)
+{
+	const size_t PRODUCER_NUM = 4;
+	FluidGPSReference reference(workload.mFlowWeights);
+	std::vector<double> referenceVFTimes;
+	for (auto pPKT: workload.mPackets)
+		referenceVFTimes.push_back(reference.HandleNewPacketArrival(pPKT));
+	std::vector<Packet *> handled;
+	{
+		//! small rings and batches, so that the producers often wait for the simulator thread
+		L_GPSIngestor ingestor(workload.mFlowWeights,[&handled](Packet *pPKT){handled.push_back(pPKT);},16);
+		std::vector<L_GPSIngestor::Producer *> producers;
+		for (size_t p = 0;p < PRODUCER_NUM;++ p)
+			producers.push_back(ingestor.AddProducer(64));
+		ingestor.start();
+		std::vector<std::thread> threads;
+		for (size_t p = 0;p < PRODUCER_NUM;++ p)
+			threads.push_back(std::thread([&workload,&producers,p](){
+				for (auto pPKT: workload.mPackets)
+					if ((size_t)(pPKT->mFlowId - 1) % PRODUCER_NUM == p)
+						producers[p]->push(pPKT);
+				producers[p]->close();
+			}));
+		for (auto& thread: threads)
+			thread.join();
+		ingestor.join();
+	}
+	double maxError = 0;
+	if (handled.size() != workload.mPackets.size())
+		maxError = std::numeric_limits<double>::infinity();
+	for (size_t i = 0;i < handled.size();++ i)
+	{
+		if (i > 0 && handled[i]->mArrivalTime < handled[i - 1]->mArrivalTime)
+			maxError = std::numeric_limits<double>::infinity();
+		maxError = std::max(maxError,relativeError(handled[i]->mGPS_VFTime,referenceVFTimes[handled[i]->mPacketId - 1]));
+	}
+	return report(workload,"ingestor order and finish times",maxError);
+}
+
+//! function to check the real finish times and the order of the departures of L_GPSDepartureEngine
+/*! a packet must leave at the first arrival after its real finish time (or at the end),
+	so the departures returned with an arrival must finish after the previous arrival and
+	no later than this one, and the distance out of this range counts as an error
+*/
+int checkDepartures(Workload& workload)
+{
+	FluidGPSReference reference(workload.mFlowWeights);
+	std::vector<double> referenceVFTimes;
+	for (auto pPKT: workload.mPackets)
+		referenceVFTimes.push_back(reference.HandleNewPacketArrival(pPKT));
+	L_GPSDepartureEngine engine(workload.mFlowWeights);
+	std::vector<Packet *> departures;
+	double maxError = 0, prevRFTime = 0, prevArrivalTime = -std::numeric_limits<double>::infinity();
+	for (size_t i = 0;i <= workload.mPackets.size();++ i)
+	{
+		double arrivalTime = std::numeric_limits<double>::infinity();
+		departures.clear();
+		if (i < workload.mPackets.size())
+		{
+			arrivalTime = workload.mPackets[i]->mArrivalTime;
+			engine.HandleNewPacketArrival(workload.mPackets[i],departures);
+		}
+		else
+			engine.Finish(departures);
+		for (auto pPKT: departures)
+		{
+			double RFTime = pPKT->mGPS_RFTime;
+			maxError = std::max(maxError,relativeError(RFTime,reference.VTime2RTime(referenceVFTimes[pPKT->mPacketId - 1])));
+			maxError = std::max(maxError,relativeError(RFTime,std::min(std::max(RFTime,prevArrivalTime),arrivalTime)));
+			maxError = std::max(maxError,relativeError(RFTime,std::max(RFTime,prevRFTime)));
+			prevRFTime = RFTime;
+		}
+		prevArrivalTime = arrivalTime;
+	}
+	if (engine.size() != 0)
+		maxError = std::numeric_limits<double>::infinity();
+	return report(workload,"departure real finish times",maxError);
+}
+
+//! function to run L_GPSNetworkSim on the topology configuration conf, returns the records of the crossings of the links
+void runNetwork(Workload& workload,const std::string& conf,std::vector<HopRecord>& records)
+{
+	const char *path = "testRegression.conf";
+	{
+		std::ofstream outfile(path);
+		outfile << conf;
+	}
+	L_GPSNetworkSim sim(workload.mFlowWeights,path);
+	std::remove(path);
+	for (auto pPKT: workload.mPackets)
+		sim.HandleNewPacketArrival(pPKT,records);
+	sim.Finish(records);
+}
+
+//! function to check the departure times of a tandem of two gps links against the reference
+/*! a third of the flows cross link 1 then link 2, a third only link 1, and the others
+	only link 2. Link 1 is checked against a reference fed with the trace, and link 2
+	against one fed with the reference departures from link 1 (after the propagation
+	delay) and the trace, so any packet missing or mistimed fails the check.
+*/
+int checkNetwork(Workload& workload)
+{
+	const double CAPACITY1 = 1.0, DELAY1 = 5.0, CAPACITY2 = 0.8;
+	std::ostringstream conf;
+	conf << "k 1 " << CAPACITY1 << " " << DELAY1 << " gps" << std::endl << "k 2 " << CAPACITY2 << " 3 gps" << std::endl;
+	for (size_t f = 1;f <= workload.mFlowWeights.size();++ f)
+		conf << "r " << f << (f % 3 == 0 ? " 1 2" : (f % 3 == 1 ? " 1" : " 2")) << std::endl;
+	std::vector<HopRecord> records;
+	runNetwork(workload,conf.str(),records);
+
+	//! reference departures of each link, by packet ID
+	size_t packetNum = workload.mPackets.size();
+	std::vector<double> departures1(packetNum + 1,std::numeric_limits<double>::quiet_NaN()), departures2 = departures1;
+	FluidGPSReference reference1(workload.mFlowWeights,CAPACITY1), reference2(workload.mFlowWeights,CAPACITY2);
+	std::vector<Packet *> packets1;
+	for (auto pPKT: workload.mPackets)
+		if (pPKT->mFlowId % 3 != 2)
+		{
+			departures1[pPKT->mPacketId] = reference1.HandleNewPacketArrival(pPKT);
+			packets1.push_back(pPKT);
+		}
+	//! arrivals at link 2 (time and packet), the packets of a flow arrive in order of ID at both links
+	std::vector<std::pair<double,Packet *> > arrivals2;
+	for (auto pPKT: packets1)
+	{
+		departures1[pPKT->mPacketId] = reference1.VTime2RTime(departures1[pPKT->mPacketId]);
+		if (pPKT->mFlowId % 3 == 0)
+			arrivals2.push_back(std::make_pair(departures1[pPKT->mPacketId] + DELAY1,pPKT));
+	}
+	for (auto pPKT: workload.mPackets)
+		if (pPKT->mFlowId % 3 == 2)
+			arrivals2.push_back(std::make_pair((double)pPKT->mArrivalTime,pPKT));
+	std::sort(arrivals2.begin(),arrivals2.end(),[](const std::pair<double,Packet *>& a1,const std::pair<double,Packet *>& a2){
+		return a1.first < a2.first || (a1.first == a2.first && a1.second->mPacketId < a2.second->mPacketId);
+	});
+	for (auto& arrival: arrivals2)
+		departures2[arrival.second->mPacketId] = reference2.HandleNewArrival(arrival.first,arrival.second->mLength,arrival.second->mFlowId);
+	for (auto& arrival: arrivals2)
+		departures2[arrival.second->mPacketId] = reference2.VTime2RTime(departures2[arrival.second->mPacketId]);
+
+	double maxError = 0;
+	if (records.size() != packets1.size() + arrivals2.size())
+		maxError = std::numeric_limits<double>::infinity();
+	for (auto& record: records)
+	{
+		std::vector<double>& departures = record.mLinkId == 1 ? departures1 : departures2;
+		double& departure = departures[record.mpPacket->mPacketId];
+		//! NaN if the packet should not cross the link or crosses it twice
+		if (std::isnan(departure))
+			maxError = std::numeric_limits<double>::infinity();
+		else
+			maxError = std::max(maxError,relativeError(record.mDepartureTime,departure));
+		departure = std::numeric_limits<double>::quiet_NaN();
+	}
+	return report(workload,"network gps departure times",maxError);
+}
+
+//! function to check the departure times of a wfq or wf2q link against the bounds of packet-by-packet GPS
+/*! a packet leaves a link of capacity C no later than Lmax / C after its fluid GPS
+	departure, where Lmax is the largest packet length, and no earlier than its
+	transmission time after its arrival
+*/
+int checkPacketScheduler(Workload& workload,const std::string& scheduler)
+{
+	const double CAPACITY = 1.0;
+	std::vector<HopRecord> records;
+	std::ostringstream conf;
+	conf << "k 1 " << CAPACITY << " 0 " << scheduler << std::endl;
+	for (size_t f = 1;f <= workload.mFlowWeights.size();++ f)
+		conf << "r " << f << " 1" << std::endl;
+	runNetwork(workload,conf.str(),records);
+
+	FluidGPSReference reference(workload.mFlowWeights,CAPACITY);
+	std::vector<double> departures(workload.mPackets.size() + 1,std::numeric_limits<double>::quiet_NaN());
+	int maxLength = 0;
+	for (auto pPKT: workload.mPackets)
+	{
+		departures[pPKT->mPacketId] = reference.HandleNewPacketArrival(pPKT);
+		maxLength = std::max(maxLength,pPKT->mLength);
+	}
+	for (auto pPKT: workload.mPackets)
+		departures[pPKT->mPacketId] = reference.VTime2RTime(departures[pPKT->mPacketId]);
+	double maxError = records.size() == workload.mPackets.size() ? 0 : std::numeric_limits<double>::infinity();
+	for (auto& record: records)
+	{
+		double departure = record.mDepartureTime;
+		double lower = record.mpPacket->mArrivalTime + record.mpPacket->mLength / CAPACITY;
+		double upper = departures[record.mpPacket->mPacketId] + maxLength / CAPACITY;
+		maxError = std::max(maxError,relativeError(departure,std::min(std::max(departure,lower),upper)));
+	}
+	return report(workload,"network " + scheduler + " departure bounds",maxError);
+}
+
+//! function to check L_GPSShardedSim against one L_GPSSim per port run one after the other
+/*! the packets are sent to PORT_NUM ports at random, and routed in two route() calls
+	with a run() in between, so that the ports of the second half mostly have a shard
+	already. The virtual finish times must be identical, and there must be one shard
+	per port.
+*/
+int checkShardedSim(Workload& workload)
+{
+	const int PORT_NUM = 4;
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> portDist(0,PORT_NUM - 1);
+	for (auto pPKT: workload.mPackets)
+		pPKT->mPortId = portDist(rng);
+	std::vector<L_GPSSim *> sims;
+	std::vector<std::vector<double> > flowLastDepartVTimes(PORT_NUM,std::vector<double>(workload.mFlowWeights.size(),0.0));
+	std::vector<double> VFTimes;
+	for (int p = 0;p < PORT_NUM;++ p)
+		sims.push_back(new L_GPSSim());
+	for (auto pPKT: workload.mPackets)
+	{
+		double& flowLastDepartVTime = flowLastDepartVTimes[pPKT->mPortId][pPKT->mFlowId - 1];
+		VFTimes.push_back(sims[pPKT->mPortId]->HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTime));
+	}
+	for (auto pSim: sims)
+		delete pSim;
+
+	L_GPSShardedSim sharded(workload.mFlowWeights,4);
+	size_t half = workload.mPackets.size() / 2;
+	sharded.route(std::vector<Packet *>(workload.mPackets.begin(),workload.mPackets.begin() + half));
+	sharded.run();
+	sharded.route(std::vector<Packet *>(workload.mPackets.begin() + half,workload.mPackets.end()));
+	sharded.run();
+	double maxError = 0;
+	std::vector<bool> isPortUsed(PORT_NUM,false);
+	for (auto pPKT: workload.mPackets)
+		isPortUsed[pPKT->mPortId] = true;
+	if (sharded.GetShards().size() != (size_t)std::count(isPortUsed.begin(),isPortUsed.end(),true))
+		maxError = std::numeric_limits<double>::infinity();
+	for (size_t i = 0;i < workload.mPackets.size();++ i)
+		if (workload.mPackets[i]->mGPS_VFTime != VFTimes[i])
+			maxError = std::numeric_limits<double>::infinity();
+	for (auto pPKT: workload.mPackets)
+		pPKT->mPortId = 0;
+	return report(workload,"sharded virtual finish times",maxError);
+}
+
+//! function to check that the RTime2VTime() kernels give results bit-identical to RTime2VTime()
+/*! at 16 points of the workload, the queries are the current real time, real times
+	before the first break point, at and next to every break point, after the last one,
+	and at random (an odd number of them, so that the SIMD kernels have a tail). The
+	lockstep descent is run with the scalar, SSE2 and AVX2 kernels (the ones supported
+	by the CPU), and the sorted batch is given the queries in order.
+*/
+int checkKernels(Workload& workload)
+{
+	const char *kernelNames[] = {"branchless descent","lockstep scalar","lockstep SSE2","lockstep AVX2","sorted batch"};
+	const int KERNEL_NUM = 5;
+	std::vector<bool> isSame(KERNEL_NUM,true);
+	std::mt19937_64 rng(5);
+	L_GPSSim sim;
+	std::vector<double> flowLastDepartVTimes(workload.mFlowWeights.size(),0.0);
+	size_t packetNum = workload.mPackets.size(), period = std::max<size_t>(1,packetNum / 16);
+	for (size_t p = 0;p < packetNum;++ p)
+	{
+		Packet *pPKT = workload.mPackets[p];
+		sim.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTimes[pPKT->mFlowId - 1]);
+		if (p % period != period - 1 && p != packetNum - 1) continue;
+
+		double curRTime = pPKT->mArrivalTime, curVTime = sim.RTime2VTime(curRTime);
+		std::vector<double> breakRTimes;
+		for (auto VTime: flowLastDepartVTimes)
+			if (VTime > curVTime)
+				breakRTimes.push_back(sim.VTime2RTime(VTime));
+		std::sort(breakRTimes.begin(),breakRTimes.end());
+		double firstRTime = breakRTimes.empty() ? curRTime + 100 : breakRTimes.front();
+		double lastRTime = breakRTimes.empty() ? curRTime + 100 : breakRTimes.back();
+		std::vector<double> times = {curRTime,lastRTime + 1,lastRTime * 2 + 1000};
+		for (int k = 1;k < 4;++ k)
+			times.push_back(curRTime + (firstRTime - curRTime) * k / 4);
+		for (auto RTime: breakRTimes)
+		{
+			times.push_back(RTime);
+			times.push_back(std::nextafter(RTime,-std::numeric_limits<double>::infinity()));
+			times.push_back(std::nextafter(RTime,std::numeric_limits<double>::infinity()));
+		}
+		std::uniform_real_distribution<double> timeDist(curRTime,lastRTime + 100);
+		while (times.size() % 2 == 0 || times.size() % 8 == 0 || times.size() < 40)
+			times.push_back(timeDist(rng));
+
+		size_t n = times.size();
+		std::vector<double> expected(n), results(n);
+		for (size_t i = 0;i < n;++ i)
+			expected[i] = sim.RTime2VTime(times[i]);
+		for (size_t i = 0;i < n;++ i)
+			results[i] = sim.RTime2VTimeBranchless(times[i]);
+		isSame[0] = isSame[0] && std::memcmp(results.data(),expected.data(),n * sizeof(double)) == 0;
+		const LockstepISA isas[] = {LOCKSTEP_SCALAR,LOCKSTEP_SSE2,LOCKSTEP_AVX2};
+		for (int k = 0;k < 3;++ k)
+		{
+			sim.RTime2VTimeLockstep(times.data(),n,results.data(),isas[k]);
+			isSame[1 + k] = isSame[1 + k] && std::memcmp(results.data(),expected.data(),n * sizeof(double)) == 0;
+		}
+		std::sort(times.begin(),times.end());
+		for (size_t i = 0;i < n;++ i)
+			expected[i] = sim.RTime2VTime(times[i]);
+		sim.RTime2VTime(times.data(),n,results.data());
+		isSame[4] = isSame[4] && std::memcmp(results.data(),expected.data(),n * sizeof(double)) == 0;
+	}
+	int failures = 0;
+	for (int k = 0;k < KERNEL_NUM;++ k)
+		failures += report(workload,kernelNames[k],isSame[k] ? 0 : std::numeric_limits<double>::infinity());
+	return failures;
+}
+
+//! function to check the heights, the balance, the aggregates and the left spine of a tree of break points
+/*! the leaves must be in increasing order of virtual time, and every internal node must
+	have two children, a height one more than the highest one, and the aggregate of its
+	children. If pLeaves is not NULL, it receives the leaves.
+*/
+int checkSubtree(BreakPointTreeNode* current,std::vector<DataField>& leaves)
+{
+	if (current->left == NULL || current->right == NULL)
+	{
+		if (current->left != NULL || current->right != NULL || current->height != 0)
+			return -1;
+		leaves.push_back(current->data);
+		return 0;
+	}
+	int leftHeight = checkSubtree(current->left,leaves), rightHeight = checkSubtree(current->right,leaves);
+	if (leftHeight < 0 || rightHeight < 0 || std::abs(leftHeight - rightHeight) > 1 || current->height != std::max(leftHeight,rightHeight) + 1)
+		return -1;
+	DataField aggregate = current->data;
+	if (L_GPSAugmentation::combine(aggregate,current->left->data,current->right->data))
+		return -1;
+	return current->height;
+}
+bool isValidTree(BreakPointTree& tree,std::vector<DataField>* pLeaves = NULL)
+{
+	std::vector<DataField> leaves;
+	const std::vector<BreakPointTreeNode*>& spine = tree.getLeftSpine();
+	BreakPointTreeNode *pRoot = tree.GetRoot();
+	if (pRoot == NULL)
+	{
+		if (pLeaves != NULL) pLeaves->clear();
+		return tree.size() == 0 && spine.empty();
+	}
+	if (checkSubtree(pRoot,leaves) < 0 || tree.size() != (int)leaves.size())
+		return false;
+	for (size_t i = 1;i < leaves.size();++ i)
+		if (!(leaves[i - 1].mVTimeMax < leaves[i].mVTimeMax))
+			return false;
+	BreakPointTreeNode *current = pRoot;
+	for (size_t i = 0;i < spine.size();++ i,current = current->left)
+		if (spine[i] != current)
+			return false;
+	if (current != NULL)
+		return false;
+	if (pLeaves != NULL)
+		pLeaves->swap(leaves);
+	return true;
+}
+
+//! function to check whether two sequences of break points have the same virtual times and weight changes
+bool isSameLeaves(const std::vector<DataField>& leaves1,const std::vector<DataField>& leaves2)
+{
+	if (leaves1.size() != leaves2.size()) return false;
+	for (size_t i = 0;i < leaves1.size();++ i)
+		if (leaves1[i].mVTimeMax != leaves2[i].mVTimeMax || leaves1[i].mDeltaWeight != leaves2[i].mDeltaWeight)
+			return false;
+	return true;
+}
+
+//! function to check that expiring the passed break points at once gives the state of removing them one by one
+/*! before every arrival, the break points passed at its arrival time are removed from
+	one L_GPSSim by ExpireBreakPoints() (which splits the tree), while the other one 
+	removes them one by one in RemoveBreakPointIfNecessary() during the arrival. Both must 
+	keep the same break points, valid trees, and the same virtual finish times and 
+	RTime2VTime() up to rounding, and several break points must be passed at once at 
+	least once.
+*/
+int checkExpiry(Workload& workload)
+{
+	L_GPSSim removing, expiring;
+	std::vector<double> removingLastDepartVTimes(workload.mFlowWeights.size(),0.0), expiringLastDepartVTimes(removingLastDepartVTimes);
+	double maxError = 0;
+	size_t maxExpired = 0;
+	for (auto pPKT: workload.mPackets)
+	{
+		double flowWeight = workload.mFlowWeights[pPKT->mFlowId - 1];
+		maxExpired = std::max(maxExpired,expiring.ExpireBreakPoints(expiring.RTime2VTime(pPKT->mArrivalTime)));
+		double VFTime = removing.HandleNewPacketArrival(pPKT,flowWeight,removingLastDepartVTimes[pPKT->mFlowId - 1]);
+		maxError = std::max(maxError,relativeError(expiring.HandleNewPacketArrival(pPKT,flowWeight,expiringLastDepartVTimes[pPKT->mFlowId - 1]),VFTime));
+
+		std::vector<DataField> removingLeaves, expiringLeaves;
+		if (!isValidTree(*removing.GetAVLTree(),&removingLeaves) || !isValidTree(*expiring.GetAVLTree(),&expiringLeaves) ||
+			removingLeaves.size() != expiringLeaves.size())
+		{
+			maxError = std::numeric_limits<double>::infinity();
+			break;
+		}
+		for (size_t i = 0;i < removingLeaves.size();++ i)
+		{
+			double time = removing.VTime2RTime(removingLeaves[i].mVTimeMax);
+			maxError = std::max(maxError,relativeError(expiringLeaves[i].mVTimeMax,removingLeaves[i].mVTimeMax));
+			maxError = std::max(maxError,relativeError(expiringLeaves[i].mDeltaWeight,removingLeaves[i].mDeltaWeight));
+			maxError = std::max(maxError,relativeError(expiring.RTime2VTime(time),removing.RTime2VTime(time)));
+		}
+	}
+	if (maxExpired < 2)
+		maxError = std::numeric_limits<double>::infinity();
+	return report(workload,"bulk expiry of break points",maxError);
+}
+
+//! function to check the concurrent readers of L_GPSSim against a serial replay of the updates
+/*! while a simulator handles the arrivals (and expires the passed break points every 8
+	arrivals), 3 threads query RTime2VTime() at random real times through L_GPSSimReader.
+	Every result must be bit-identical to RTime2VTime() of a second simulator replaying 
+	the same updates serially, after the number of updates the reader saw, and the 
+	readers must see several states. Built with -fsanitize=thread, this also checks the 
+	synchronization of the seqlock and of the retired nodes.
+*/
+int checkConcurrentReaders(Workload& workload)
+{
+	const int READER_NUM = 3;
+	const size_t MAX_READ_NUM = 100000;
+	//! query of a reader, and the number of updates before the state it saw
+	struct Read{
+		double RTime;
+		double VTime;
+		uint64_t updateNum;
+	};
+	//! function to run the updates, onUpdate() is called with the number of updates made before and after each of them
+	auto run = [&workload](L_GPSSim& sim,const std::function<void(uint64_t)>& onUpdate){
+		std::vector<double> flowLastDepartVTimes(workload.mFlowWeights.size(),0.0);
+		uint64_t updateNum = 0;
+		onUpdate(updateNum);
+		for (size_t i = 0;i < workload.mPackets.size();++ i)
+		{
+			Packet *pPKT = workload.mPackets[i];
+			sim.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTimes[pPKT->mFlowId - 1]);
+			onUpdate(++ updateNum);
+			if (i % 8 == 7)
+			{
+				sim.ExpireBreakPoints(sim.RTime2VTime(pPKT->mArrivalTime));
+				onUpdate(++ updateNum);
+			}
+		}
+	};
+	double lastRTime = workload.mPackets.empty() ? 0 : workload.mPackets.back()->mArrivalTime;
+	std::vector<std::vector<Read> > reads(READER_NUM);
+	{
+		L_GPSSim sim;
+		sim.EnableConcurrentReaders();
+		std::atomic<int> startedNum(0);
+		std::atomic<bool> isDone(false);
+		std::vector<std::thread> readers;
+		for (int r = 0;r < READER_NUM;++ r)
+			readers.push_back(std::thread([&,r]{
+				L_GPSSimReader reader(sim);
+				std::mt19937_64 rng(17 + r);
+				std::uniform_real_distribution<double> timeDist(0,lastRTime * 1.1 + 1);
+				while (reads[r].size() < MAX_READ_NUM && (reads[r].empty() || !isDone.load()))
+				{
+					Read read;
+					read.RTime = timeDist(rng);
+					read.VTime = reader.RTime2VTime(read.RTime,&read.updateNum);
+					reads[r].push_back(read);
+					if (reads[r].size() == 1)
+						++ startedNum;
+					//! the threads take turns even on a single core
+					std::this_thread::yield();
+				}
+			}));
+		//! the updates start once every reader is reading
+		while (startedNum.load() < READER_NUM)
+			std::this_thread::yield();
+		run(sim,[](uint64_t){ std::this_thread::yield(); });
+		isDone = true;
+		for (auto& reader: readers)
+			reader.join();
+	}
+
+	std::vector<Read> allReads;
+	for (auto& readerReads: reads)
+		allReads.insert(allReads.end(),readerReads.begin(),readerReads.end());
+	std::stable_sort(allReads.begin(),allReads.end(),[](const Read& r1,const Read& r2){ return r1.updateNum < r2.updateNum; });
+	L_GPSSim replay;
+	size_t next = 0, stateNum = 0, mismatchNum = 0;
+	run(replay,[&](uint64_t updateNum){
+		if (next < allReads.size() && allReads[next].updateNum == updateNum)
+			++ stateNum;
+		for (;next < allReads.size() && allReads[next].updateNum == updateNum;++ next)
+		{
+			double VTime = replay.RTime2VTime(allReads[next].RTime);
+			if (std::memcmp(&VTime,&allReads[next].VTime,sizeof(VTime)) != 0)
+				++ mismatchNum;
+		}
+	});
+	bool isPassed = next == allReads.size() && mismatchNum == 0 && stateNum >= 2;
+	return report(workload,"concurrent readers",isPassed ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to check AVL_Tree::join() and AVL_Tree::split() on trees of uneven heights
+/*! trees of 1 to 3000 break points (built by random insertions, so their subtrees are
+	of uneven heights) are joined in both orders of size, and split at every kind of key
+	(before the first leaf, at a leaf, between two leaves and after the last one). The
+	results must be valid trees with the expected leaves.
+*/
+int checkSplitJoin()
+{
+	std::mt19937_64 rng(15);
+	std::uniform_real_distribution<double> weightDist(-4.0,4.0);
+	//! function to build a tree of the break points at the virtual times first, first + 2, ... (count of them) in random order
+	auto build = [&](BreakPointTree& tree,int first,int count,std::vector<DataField>& leaves){
+		leaves.clear();
+		for (int i = 0;i < count;++ i)
+			leaves.push_back(DataField(first + 2 * i,weightDist(rng)));
+		std::vector<DataField> shuffled(leaves);
+		std::shuffle(shuffled.begin(),shuffled.end(),rng);
+		for (auto& data: shuffled)
+			tree.insert(data);
+	};
+	bool isValid = true;
+	const int sizes[][2] = {{1,1},{1,2},{2,1},{1,3000},{3000,1},{3,700},{700,3},{40,41},{1000,1000}};
+	for (auto& size: sizes)
+	{
+		BreakPointTree left, right;
+		std::vector<DataField> leftLeaves, rightLeaves, leaves;
+		build(left,0,size[0],leftLeaves);
+		build(right,2 * size[0],size[1],rightLeaves);
+		left.join(right);
+		leftLeaves.insert(leftLeaves.end(),rightLeaves.begin(),rightLeaves.end());
+		isValid = isValid && isValidTree(left,&leaves) && isSameLeaves(leaves,leftLeaves) && isValidTree(right) && right.size() == 0;
+		//! the trees do not free their nodes by themselves
+		left.clear();
+		right.clear();
+	}
+	for (int count: {1,2,5,3000})
+	{
+		std::vector<DataField> allLeaves, leaves;
+		for (double key: {-1.0,0.0,1.0,(double)(count / 2 * 2),(double)(count / 2 * 2 + 1),(double)(2 * count - 2),(double)(2 * count)})
+		{
+			BreakPointTree left, right;
+			build(left,0,count,allLeaves);
+			DataField data(key,0);
+			left.split(data,right);
+			size_t leftNum = 0;
+			while (leftNum < allLeaves.size() && allLeaves[leftNum].mVTimeMax <= key)
+				++ leftNum;
+			isValid = isValid && isValidTree(left,&leaves) && isSameLeaves(leaves,std::vector<DataField>(allLeaves.begin(),allLeaves.begin() + leftNum));
+			isValid = isValid && isValidTree(right,&leaves) && isSameLeaves(leaves,std::vector<DataField>(allLeaves.begin() + leftNum,allLeaves.end()));
+			left.join(right);
+			isValid = isValid && isValidTree(left,&leaves) && isSameLeaves(leaves,allLeaves);
+			left.clear();
+			right.clear();
+		}
+	}
+	return report("AVL tree","split and join of uneven trees",isValid ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to check AVL_Tree::unionSorted() against the insertion of the same break points one by one
+/*! batches of more than 2 * UNION_PARALLEL_GRAIN break points (so that the union forks
+	threads, on two levels for the largest one) are inserted in trees of 0 to 50000 break
+	points, with 1 and 4 threads. The keys are drawn from a range smaller than the number
+	of break points, so many of them are already in the tree or repeated in the batch,
+	and must be merged into one leaf. The weight changes are small positive integers, so
+	the sums are exact in any order and no leaf cancels out. The result must be a valid
+	tree with the leaves of the one built by mergeIntoLeaf() or insert().
+*/
+int checkUnion()
+{
+	std::mt19937_64 rng(16);
+	std::uniform_int_distribution<int> weightDist(1,4);
+	bool isValid = true;
+	const size_t sizes[][2] = {{0,20000},{6000,20000},{20000,60000},{50000,12000}};
+	for (auto& size: sizes)
+	{
+		std::uniform_int_distribution<int> keyDist(-100,(int)(size[0] + size[1]) * 2 / 3);
+		std::vector<DataField> existing, batch;
+		for (size_t i = 0;i < size[0];++ i)
+			existing.push_back(DataField(3 * (int)i,weightDist(rng)));
+		for (size_t i = 0;i < size[1];++ i)
+			batch.push_back(DataField(keyDist(rng),weightDist(rng)));
+		std::stable_sort(batch.begin(),batch.end(),Compare_VTM_L());
+
+		BreakPointTree expected;
+		for (auto data: existing)
+			expected.insert(data);
+		for (auto data: batch)
+			if (!expected.mergeIntoLeaf(data))
+				expected.insert(data);
+		std::vector<DataField> expectedLeaves, leaves;
+		isValid = isValid && isValidTree(expected,&expectedLeaves);
+		for (unsigned threadNum: {1u,4u})
+		{
+			BreakPointTree tree;
+			tree.buildFromSortedLeaves(existing.data(),existing.size());
+			tree.unionSorted(batch.data(),batch.size(),threadNum);
+			isValid = isValid && isValidTree(tree,&leaves) && isSameLeaves(leaves,expectedLeaves);
+			tree.clear();
+		}
+		expected.clear();
+	}
+	return report("AVL tree","union with a sorted batch",isValid ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! brute-force fluid H-GPS server
+/*! the link serves the backlogged flows at rates found top-down at every step: the rate
+	of a backlogged class is shared among its backlogged children (flows and classes)
+	in proportion to their weights. Every step runs until the next arrival or until a
+	flow empties, and records the amount of service received by every class. Class 0 is
+	the root, and the parent of a class must have a lower index.
+*/
+class FluidHGPSReference{
+	std::vector<int> mClassParents;
+	std::vector<double> mClassWeights;
+	std::vector<double> mFlowWeights;
+	std::vector<int> mFlowClasses;
+	//! remaining work of every flow and service received by every class
+	std::vector<double> mBacklogs;
+	std::vector<double> mClassServices;
+	double mTime;
+public:
+	FluidHGPSReference(const std::vector<int>& classParents,const std::vector<double>& classWeights,const std::vector<double>& flowWeights,const std::vector<int>& flowClasses)
+	{
+		mClassParents = classParents;
+		mClassWeights = classWeights;
+		mFlowWeights = flowWeights;
+		mFlowClasses = flowClasses;
+		mBacklogs.assign(flowWeights.size(),0.0);
+		mClassServices.assign(classParents.size(),0.0);
+		mTime = 0;
+	}
+	//! function to serve until time
+	void Serve(double time)
+	{
+		size_t classNum = mClassParents.size();
+		while (mTime < time)
+		{
+			std::vector<bool> isBacklogged(classNum,false);
+			std::vector<double> sumWeights(classNum,0.0), rates(classNum,0.0);
+			for (size_t f = 0;f < mFlowWeights.size();++ f)
+				if (mBacklogs[f] > 0)
+				{
+					sumWeights[mFlowClasses[f]] += mFlowWeights[f];
+					for (int c = mFlowClasses[f];c >= 0 && !isBacklogged[c];c = mClassParents[c])
+						isBacklogged[c] = true;
+				}
+			if (!isBacklogged[0])
+			{
+				mTime = time;
+				return;
+			}
+			for (size_t c = 1;c < classNum;++ c)
+				if (isBacklogged[c])
+					sumWeights[mClassParents[c]] += mClassWeights[c];
+			rates[0] = 1.0;
+			for (size_t c = 1;c < classNum;++ c)
+				if (isBacklogged[c])
+					rates[c] = rates[mClassParents[c]] * mClassWeights[c] / sumWeights[mClassParents[c]];
+			//! the step ends at the first flow emptying, or at time
+			double step = time - mTime;
+			size_t emptied = mFlowWeights.size();
+			for (size_t f = 0;f < mFlowWeights.size();++ f)
+				if (mBacklogs[f] > 0)
+				{
+					int c = mFlowClasses[f];
+					double flowStep = mBacklogs[f] / (rates[c] * mFlowWeights[f] / sumWeights[c]);
+					if (flowStep <= step)
+					{
+						step = flowStep;
+						emptied = f;
+					}
+				}
+			for (size_t f = 0;f < mFlowWeights.size();++ f)
+				if (mBacklogs[f] > 0)
+				{
+					int c = mFlowClasses[f];
+					mBacklogs[f] -= rates[c] * mFlowWeights[f] / sumWeights[c] * step;
+					//! flows emptying at the same time as the emptied one are left with rounding errors
+					if (f == emptied || mBacklogs[f] < 1e-9)
+						mBacklogs[f] = 0;
+				}
+			for (size_t c = 0;c < classNum;++ c)
+				mClassServices[c] += rates[c] * step;
+			mTime += step;
+		}
+	}
+	//! get the service received by a class so far
+	double GetClassService(int classId)
+	{
+		return mClassServices[classId];
+	}
+	//! function to add length units of work to a flow at the current time
+	void AddWork(int flowId,double length)
+	{
+		mBacklogs[flowId - 1] += length;
+	}
+};
+
+//! function to check L_HGPSSim with a single class and with two levels of classes
+/*! a single class of weight 1 holding all the flows must give the virtual finish times
+	of a flat L_GPSSim. With two levels, the classes are
+		root -> 1 (weight 2), 2 (weight 1)
+		1 -> 3 (weight 3), 4 (weight 0.5)
+	and flow f belongs to class f % 5, so the root and class 1 have both flows and
+	classes as children. The reference gives the service received by every class from a
+	fluid H-GPS server, and every class on the path of a packet is checked with a fluid
+	GPS reference over its children, whose real time is the service of the class.
+*/
+int checkHierarchical(Workload& workload)
+{
+	const char *path = "testRegression.conf";
+	size_t flowNum = workload.mFlowWeights.size();
+	int failures = 0;
+	{
+		std::ofstream outfile(path);
+		outfile << "n 1 0 1" << std::endl;
+		for (size_t f = 1;f <= flowNum;++ f)
+			outfile << "l " << f << " 1" << std::endl;
+	}
+	{
+		L_HGPSSim hierarchical(workload.mFlowWeights,path);
+		L_GPSSim flat;
+		std::vector<double> flowLastDepartVTimes(flowNum,0.0);
+		double maxError = 0;
+		for (auto pPKT: workload.mPackets)
+		{
+			double VFTime = flat.HandleNewPacketArrival(pPKT,workload.mFlowWeights[pPKT->mFlowId - 1],flowLastDepartVTimes[pPKT->mFlowId - 1]);
+			maxError = std::max(maxError,relativeError(hierarchical.HandleNewPacketArrival(pPKT),VFTime));
+		}
+		failures += report(workload,"H-GPS single class",maxError);
+	}
+
+	const std::vector<int> classParents = {-1,0,0,1,1};
+	const std::vector<double> classWeights = {1.0,2.0,1.0,3.0,0.5};
+	std::vector<int> flowClasses;
+	{
+		std::ofstream outfile(path);
+		for (size_t c = 1;c < classParents.size();++ c)
+			outfile << "n " << c << " " << classParents[c] << " " << classWeights[c] << std::endl;
+		for (size_t f = 1;f <= flowNum;++ f)
+		{
+			flowClasses.push_back(f % 5);
+			if (f % 5 != 0)
+				outfile << "l " << f << " " << f % 5 << std::endl;
+		}
+	}
+	L_HGPSSim hierarchical(workload.mFlowWeights,path);
+	std::remove(path);
+	FluidHGPSReference reference(classParents,classWeights,workload.mFlowWeights,flowClasses);
+	//! the children of a class are the flows (1 to flowNum) and the classes (flowNum + 1 on)
+	std::vector<double> childWeights(workload.mFlowWeights);
+	childWeights.insert(childWeights.end(),classWeights.begin(),classWeights.end());
+	std::vector<FluidGPSReference> classReferences(classParents.size(),FluidGPSReference(childWeights));
+	double maxError = 0;
+	for (auto pPKT: workload.mPackets)
+	{
+		reference.Serve(pPKT->mArrivalTime);
+		std::vector<int> classPath;
+		for (int c = flowClasses[pPKT->mFlowId - 1];c >= 0;c = classParents[c])
+			classPath.insert(classPath.begin(),c);
+		double VFTime = 0;
+		for (size_t i = 0;i < classPath.size();++ i)
+		{
+			int c = classPath[i];
+			double classRTime = c == 0 ? pPKT->mArrivalTime : reference.GetClassService(c);
+			int childId = i + 1 < classPath.size() ? (int)flowNum + classPath[i + 1] + 1 : pPKT->mFlowId;
+			VFTime = classReferences[c].HandleNewArrival(classRTime,pPKT->mLength,childId);
+		}
+		reference.AddWork(pPKT->mFlowId,pPKT->mLength);
+		maxError = std::max(maxError,relativeError(hierarchical.HandleNewPacketArrival(pPKT),VFTime));
+	}
+	failures += report(workload,"H-GPS two levels",maxError);
+	return failures;
+}
+
+//! class to discard what is printed to std::cout during its lifetime (the tester reports its progress)
+class QuietCout{
+	std::ostringstream mSink;
+	std::streambuf *mpOld;
+public:
+	QuietCout()
+	{
+		mpOld = std::cout.rdbuf(mSink.rdbuf());
+	}
+	~QuietCout()
+	{
+		std::cout.rdbuf(mpOld);
+	}
+};
+
+//! function to write packets (in the given order) as a trace file, with a comment line every 50 packets
+void writeTrace(const std::vector<double>& flowWeights,const std::vector<Packet *>& packets,const std::string& path)
+{
+	std::ofstream ofs(path);
+	ofs << "f " << flowWeights.size() << " neq" << std::endl << "w";
+	for (auto weight: flowWeights)
+		ofs << " " << std::setprecision(17) << weight;
+	ofs << std::endl;
+	for (size_t i = 0;i < packets.size();++ i)
+	{
+		Packet *pPKT = packets[i];
+		if (i % 50 == 0)
+			ofs << "c packets " << i << " and next" << std::endl;
+		ofs << "p " << pPKT->mFlowId << " " << pPKT->mPacketId << " " << pPKT->mArrivalTime << " " << pPKT->mLength;
+		if (pPKT->mPortId != 0)
+			ofs << " " << pPKT->mPortId;
+		ofs << std::endl;
+	}
+}
+
+//! function to read the packets saved by the tester
+json readResults()
+{
+	std::ifstream ifs("gps_output.json");
+	return json::parse(ifs)["packets"];
+}
+
+//! function to check that the pipelined mode of L_GPS_Tester saves the same results as run()
+/*! small batches and queues, so that the three stages often wait for each other
+*/
+int checkPipelined(Workload& workload)
+{
+	const char *path = "testRegression.dat";
+	writeTrace(workload.mFlowWeights,workload.mPackets,path);
+	json expected, results;
+	{
+		QuietCout quiet;
+		{
+			L_GPS_Tester tester(path);
+			tester.run();
+		}
+		expected = readResults();
+		{
+			L_GPS_Tester tester(path,false);
+			tester.runPipelined(7,2);
+		}
+		results = readResults();
+	}
+	std::remove(path);
+	std::remove("gps_output.json");
+	std::remove("avl_tree.txt");
+	bool isEqual = expected.size() == workload.mPackets.size() && results == expected;
+	return report(workload,"pipelined tester results",isEqual ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to compare two sequences of packets field by field
+bool isSamePackets(const std::vector<Packet *>& packets1,const std::vector<Packet *>& packets2)
+{
+	if (packets1.size() != packets2.size()) return false;
+	for (size_t i = 0;i < packets1.size();++ i)
+	{
+		const Packet *p1 = packets1[i], *p2 = packets2[i];
+		if (p1->mFlowId != p2->mFlowId || p1->mPacketId != p2->mPacketId || p1->mArrivalTime != p2->mArrivalTime ||
+			p1->mLength != p2->mLength || p1->mPortId != p2->mPortId)
+			return false;
+	}
+	return true;
+}
+
+//! function to check TraceReader::readAllParallel() against reading the packets one by one
+/*! the packets are written out of arrival order (with some output ports), and they
+	are read back by 4 threads in ranges of at least 1, 37 and 1000 bytes, so that most
+	ranges start and end in the middle of a line. In file order the packets must be the
+	same as the ones read by next(), and merged by arrival time they must be the same
+	as the ones read by next() and stably sorted.
+*/
+int checkParallelParsing(Workload& workload)
+{
+	const char *path = "testRegression.dat";
+	std::mt19937 rng(9);
+	std::uniform_int_distribution<int> jitterDist(0,3000);
+	std::vector<std::pair<long int,Packet *> > jittered;
+	for (auto pPKT: workload.mPackets)
+		jittered.push_back(std::make_pair(pPKT->mArrivalTime + jitterDist(rng),pPKT));
+	std::stable_sort(jittered.begin(),jittered.end(),[](const std::pair<long int,Packet *>& p1,const std::pair<long int,Packet *>& p2){ return p1.first < p2.first; });
+	std::vector<Packet *> shuffled;
+	for (auto& p: jittered)
+	{
+		p.second->mPortId = p.second->mPacketId % 3;
+		shuffled.push_back(p.second);
+	}
+	writeTrace(workload.mFlowWeights,shuffled,path);
+	for (auto pPKT: workload.mPackets)
+		pPKT->mPortId = 0;
+
+	std::vector<Packet *> expected, sortedExpected;
+	TraceReader reader(path);
+	Packet *pPKT;
+	while ((pPKT = reader.next()) != NULL)
+		expected.push_back(pPKT);
+	sortedExpected = expected;
+	std::stable_sort(sortedExpected.begin(),sortedExpected.end(),PKT_Compare_AT_L());
+	bool isEqual = expected.size() == workload.mPackets.size();
+	const std::streamoff chunkSizes[] = {1,37,1000};
+	for (auto chunkSize: chunkSizes)
+		for (int mergeByArrival = 0;mergeByArrival < 2;++ mergeByArrival)
+		{
+			std::vector<Packet *> packets;
+			TraceReader parallelReader(path);
+			parallelReader.readAllParallel(packets,4,mergeByArrival != 0,chunkSize);
+			isEqual = isEqual && isSamePackets(packets,mergeByArrival ? sortedExpected : expected);
+			for (auto pPKT: packets)
+				delete pPKT;
+		}
+	for (auto pPKT: expected)
+		delete pPKT;
+	std::remove(path);
+	return report(workload,"parallel trace parsing",isEqual ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to check that ArrivalSorter gives the same order as std::stable_sort
+/*! the arrival times are drawn from timeRange values starting at minTime, so many
+	packets arrive at the same time, and the packets are given as runNum sorted runs
+	(or in random order if runNum is 0)
+*/
+int checkArrivalSort(const std::string& name,unsigned seed,size_t packetNum,size_t runNum,long int minTime,long int timeRange,unsigned threadNum)
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_int_distribution<long int> timeDist(minTime,minTime + timeRange - 1);
+	std::vector<Packet *> packets;
+	for (size_t i = 0;i < packetNum;++ i)
+		packets.push_back(new Packet(1,i + 1,64,timeDist(rng)));
+	for (size_t r = 0;r < runNum;++ r)
+		std::stable_sort(packets.begin() + packetNum * r / runNum,packets.begin() + packetNum * (r + 1) / runNum,PKT_Compare_AT_L());
+	std::vector<Packet *> expected(packets);
+	std::stable_sort(expected.begin(),expected.end(),PKT_Compare_AT_L());
+	SortPacketsByArrival(packets,threadNum);
+	bool isEqual = packets == expected;
+	for (auto pPKT: packets)
+		delete pPKT;
+	return report(name,"stable arrival sort",isEqual ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to check that ExternalArrivalSorter gives the same order as std::stable_sort
+/*! the memory budget of a few thousand bytes forces tens of runs, which are merged in
+	several passes of at most maxFanIn runs. Two sorters are fed in turns in the same
+	directory, so that their run files coexist.
+*/
+int checkExternalSort(const std::string& name,unsigned seed,size_t packetNum,size_t memoryBudget,size_t maxFanIn)
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_int_distribution<long int> timeDist(0,1000);
+	std::vector<Packet *> expected[2];
+	ExternalArrivalSorter sorter0(memoryBudget,".",1,maxFanIn), sorter1(memoryBudget,".",1,maxFanIn);
+	ExternalArrivalSorter *sorters[2] = {&sorter0,&sorter1};
+	for (size_t i = 0;i < packetNum;++ i)
+		for (int s = 0;s < 2;++ s)
+		{
+			Packet *pPKT = new Packet(s + 1,i + 1,64 + i % 1000,timeDist(rng),i % 3);
+			expected[s].push_back(new Packet(*pPKT));
+			sorters[s]->add(pPKT);
+		}
+	bool isEqual = true;
+	for (int s = 0;s < 2;++ s)
+	{
+		std::stable_sort(expected[s].begin(),expected[s].end(),PKT_Compare_AT_L());
+		std::vector<Packet *> packets;
+		Packet *pPKT;
+		while ((pPKT = sorters[s]->next()) != NULL)
+			packets.push_back(pPKT);
+		isEqual = isEqual && sorters[s]->GetRunNum() > maxFanIn * maxFanIn && sorters[s]->GetMergePassNum() >= 2;
+		isEqual = isEqual && isSamePackets(packets,expected[s]);
+		for (auto pPKT: packets)
+			delete pPKT;
+		for (auto pPKT: expected[s])
+			delete pPKT;
+	}
+	return report(name,"external arrival sort",isEqual ? 0 : std::numeric_limits<double>::infinity());
+}
+
+//! function to run all the checks on a workload, returns the number of failed checks
+int checkWorkload(Workload& workload)
+{
+	int failures = 0;
+	failures += checkFinishTimes<L_GPSSim>(workload,"L_GPSSim");
+	failures += checkFinishTimes<L_GPSGenericSim<AVLBreakPointIndex> >(workload,"AVL index");
+	failures += checkFinishTimes<L_GPSGenericSim<RBBreakPointIndex> >(workload,"red-black index");
+	failures += checkFinishTimes<L_GPSGenericSim<TreapBreakPointIndex> >(workload,"treap index");
+	failures += checkFinishTimes<L_GPSGenericSim<SkipListBreakPointIndex> >(workload,"skip list index");
+	failures += checkFinishTimes<L_GPSSnapshotSim>(workload,"snapshot sim");
+	failures += checkCheckpoint(workload);
+	failures += checkIngestor(workload);
+	failures += checkDepartures(workload);
+	failures += checkNetwork(workload);
+	failures += checkPacketScheduler(workload,"wfq");
+	failures += checkPacketScheduler(workload,"wf2q");
+	failures += checkShardedSim(workload);
+	failures += checkHierarchical(workload);
+	failures += checkKernels(workload);
+	failures += checkExpiry(workload);
+	failures += checkConcurrentReaders(workload);
+	return failures;
+}
+
+int main()
+{
+	struct WorkloadSpec{
+		const char *mName;
+		unsigned mSeed;
+		size_t mPacketNum;
+		size_t mFlowNum;
+		double mLoad;
+	};
+	const WorkloadSpec specs[] = {
+		{"light, 5 flows",1,2000,5,0.5},
+		{"light, 50 flows",2,4000,50,0.5},
+		{"busy, 50 flows",3,4000,50,0.98},
+		{"overload, 20 flows",4,3000,20,1.2}
+	};
+	int failures = 0;
+	std::cout << std::left << std::setw(20) << "workload" << std::setw(40) << "check" << std::setw(12) << "max error" << "result" << std::endl;
+	for (auto& spec: specs)
+	{
+		Workload workload;
+		makeWorkload(workload,spec.mName,spec.mSeed,spec.mPacketNum,spec.mFlowNum,spec.mLoad);
+		failures += checkWorkload(workload);
+		//! the checks through trace files are only run on one workload
+		if (spec.mSeed == 3)
+		{
+			failures += checkPipelined(workload);
+			failures += checkParallelParsing(workload);
+		}
+	}
+	//! two break points of the same virtual time are passed at the last arrival, the skip list used to keep one of them
+	{
+		Workload workload;
+		workload.mName = "passed break points";
+		workload.mFlowWeights = {1.0,0.89};
+		const long int packets[][3] = {{2,186,18},{1,394,151},{2,394,56},{1,601,113},{2,660,152}};
+		for (auto& packet: packets)
+			workload.mPackets.push_back(new Packet((int)packet[0],workload.mPackets.size() + 1,(int)packet[2],packet[1]));
+		failures += checkWorkload(workload);
+	}
+	//! natural merge sort (at most 16 runs), radix sort, and radix sort in parallel blocks
+	failures += checkArrivalSort("10 sorted runs",10,5000,10,0,50,1);
+	failures += checkArrivalSort("random order",11,5000,0,-300,1000,1);
+	failures += checkArrivalSort("large times",12,5000,0,1L << 40,1 << 20,1);
+	failures += checkArrivalSort("random, 4 threads",13,200000,0,0,5000,4);
+	failures += checkExternalSort("spilled, fan-in 3",14,20000,4096,3);
+	failures += checkSplitJoin();
+	failures += checkUnion();
+	std::cout << (failures == 0 ? "all checks passed" : "some checks FAILED") << std::endl;
+	return failures;
+}
@@ -0,0 +1,200 @@
+/*
+	A small work-stealing thread pool.
+
+	Every worker owns a task deque: tasks submitted from inside a worker are pushed
+	to (and popped from) the back of its own deque, while idle workers steal from the
+	front of the other deques. Tasks submitted from outside the pool are spread over
+	the workers in a round-robin manner. An exception escaping a task is kept and
+	rethrown by wait() (the first one only, if several tasks fail).
+*/
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception> // for exception_ptr
+#include <algorithm> // for max
+#include <stdexcept> // for runtime_error
+
+//! class for a work-stealing thread pool
+class WorkStealingPool{
+	//! task queue owned by one worker
+	struct Worker{
+		std::mutex mLock;
+		std::deque<std::function<void()> > mTasks;
+	};
+	//! task queues, one per worker
+	std::vector<Worker *> mWorkers;
+	//! worker threads
+	std::vector<std::thread> mThreads;
+	//! number of submitted tasks which are not finished yet
+	std::atomic<long> mPending;
+	//! number of tasks sitting in the queues
+	std::atomic<long> mQueued;
+	//! set when the pool is destroyed
+	std::atomic<bool> mStop;
+	//! next worker to receive an external submission
+	std::atomic<unsigned> mNextWorker;
+	//! lock and condition variables used to park idle workers and waiters
+	std::mutex mIdleLock;
+	std::condition_variable mIdleCV;
+	std::condition_variable mDoneCV;
+	//! first exception thrown by a task since the last wait() (guarded by mIdleLock)
+	std::exception_ptr mError;
+
+	//! pool and index of the worker running on the calling thread
+	struct WorkerIdentity{
+		WorkStealingPool *mpPool;
+		int mIndex;
+	};
+	static WorkerIdentity& CurrentIdentity()
+	{
+		static thread_local WorkerIdentity identity = {NULL,-1};
+		return identity;
+	}
+	//! index of the worker of this pool running on the calling thread (-1 for other threads)
+	int CurrentWorker()
+	{
+		WorkerIdentity& identity = CurrentIdentity();
+		return identity.mpPool == this ? identity.mIndex : -1;
+	}
+	//! function to block until all the submitted tasks are finished, without rethrowing
+	void WaitIdle(std::unique_lock<std::mutex>& lock)
+	{
+		mDoneCV.wait(lock,[this]{ return mPending == 0; });
+	}
+	//! function to pop a task from the back of worker i's own deque
+	bool PopLocal(unsigned i,std::function<void()>& task)
+	{
+		std::lock_guard<std::mutex> guard(mWorkers[i]->mLock);
+		if (mWorkers[i]->mTasks.empty()) return false;
+		task = std::move(mWorkers[i]->mTasks.back());
+		mWorkers[i]->mTasks.pop_back();
+		return true;
+	}
+	//! function to steal a task from the front of another worker's deque
+	bool Steal(unsigned i,std::function<void()>& task)
+	{
+		for (size_t k = 1;k < mWorkers.size();++ k)
+		{
+			Worker *victim = mWorkers[(i + k) % mWorkers.size()];
+			std::lock_guard<std::mutex> guard(victim->mLock);
+			if (victim->mTasks.empty()) continue;
+			task = std::move(victim->mTasks.front());
+			victim->mTasks.pop_front();
+			return true;
+		}
+		return false;
+	}
+	//! main loop of worker i
+	void WorkerLoop(unsigned i)
+	{
+		CurrentIdentity().mpPool = this;
+		CurrentIdentity().mIndex = i;
+		std::function<void()> task;
+		while (true)
+		{
+			if (PopLocal(i,task) || Steal(i,task))
+			{
+				-- mQueued;
+				try{
+					task();
+				}
+				catch(...)
+				{
+					std::lock_guard<std::mutex> guard(mIdleLock);
+					if (!mError)
+						mError = std::current_exception();
+				}
+				task = nullptr;
+				if (-- mPending == 0)
+				{
+					std::lock_guard<std::mutex> guard(mIdleLock);
+					mDoneCV.notify_all();
+				}
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mIdleLock);
+			mIdleCV.wait(lock,[this]{ return mStop || mQueued > 0; });
+			if (mStop && mQueued == 0) return;
+		}
+	}
+public:
+	//! constructor
+	/*! threadNum = 0 means one worker per hardware thread
+	*/
+	explicit WorkStealingPool(unsigned threadNum = 0)
+	{
+		if (threadNum == 0)
+			threadNum = std::max(1u,std::thread::hardware_concurrency());
+		mPending = 0;
+		mQueued = 0;
+		mStop = false;
+		mNextWorker = 0;
+		for (unsigned i = 0;i < threadNum;++ i)
+			mWorkers.push_back(new Worker());
+		for (unsigned i = 0;i < threadNum;++ i)
+			mThreads.push_back(std::thread(&WorkStealingPool::WorkerLoop,this,i));
+	}
+	//! destructor, waits for all the submitted tasks
+	~WorkStealingPool()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mIdleLock);
+			WaitIdle(lock);
+		}
+		{
+			std::lock_guard<std::mutex> guard(mIdleLock);
+			mStop = true;
+		}
+		mIdleCV.notify_all();
+		for (auto& t: mThreads)
+			t.join();
+		for (auto w: mWorkers)
+			delete w;
+	}
+	//! function to submit a task
+	void submit(std::function<void()> task)
+	{
+		if (mStop)
+			throw new std::runtime_error("Cannot submit task to a stopped thread pool.");
+		int self = CurrentWorker();
+		unsigned i = (self >= 0 && self < (int)mWorkers.size()) ? (unsigned)self : (mNextWorker ++) % mWorkers.size();
+		++ mPending;
+		{
+			std::lock_guard<std::mutex> guard(mWorkers[i]->mLock);
+			mWorkers[i]->mTasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> guard(mIdleLock);
+			++ mQueued;
+		}
+		mIdleCV.notify_one();
+	}
+	//! function to block until all the submitted tasks are finished
+	/*! if a task threw an exception, it is rethrown here (and cleared)
+	*/
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mIdleLock);
+		WaitIdle(lock);
+		if (mError)
+		{
+			std::exception_ptr error = mError;
+			mError = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+	//! get the number of worker threads
+	unsigned size()
+	{
+		return mThreads.size();
+	}
+};
+
+#endif
@@ -0,0 +1,328 @@
+/*
+    Streaming reader for packet trace files.
+
+    A trace file starts with the flow configuration:
+        f <flow number> <eq|neq>
+        w <weight of flow 1> ... <weight of flow n>   (only for neq)
+    followed by one line per packet:
+        p <flow ID> <packet ID> <arrival time> <packet length> [<port ID>]
+    Lines starting with c are comments.
+*/
+#ifndef TRACE_READER_HPP
+#define TRACE_READER_HPP
+
+#include <stdexcept> // for runtime_error
+#include <fstream>
+#include <sstream> // for istringstream
+#include <vector>
+#include <string> // for string & getline
+#include <cstdlib> // for strtol
+#include <thread>
+#include <queue> // for priority_queue
+#include <algorithm> // for stable_sort
+#include <exception> // for exception_ptr
+#include <atomic>
+#include <functional> // for greater
+
+#include "packet.hpp"
+
+//! class to read the flow configuration and the packets of a trace file
+class TraceReader{
+    //! input file stream
+    std::ifstream mInfile;
+    //! weight of each flow
+    std::vector<double> mFlowWeights;
+    //! path of the input file
+    std::string mInput;
+    //! offset of the first byte after the flow configuration
+    std::streamoff mDataOffset;
+    //! function to parse an integer field of a packet line
+    static long int parseField(const char*& pos,const char* end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t')) ++ pos;
+        char *stop;
+        long int value = std::strtol(pos,&stop,10);
+        if (stop == pos || stop > end)
+            throw new std::runtime_error("Missing or wrong packet description.");
+        pos = stop;
+        return value;
+    }
+    //! function to parse the packet lines in the byte range [begin,end) of a buffer
+    /*! the buffer must be terminated by a newline or a null character
+    */
+    static void parseChunk(const char* begin,const char* end,std::vector<Packet *>& packets)
+    {
+        const char *pos = begin;
+        while (pos < end)
+        {
+            while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) ++ pos;
+            if (pos == end) break;
+            const char *lineEnd = pos;
+            while (lineEnd < end && *lineEnd != '\n') ++ lineEnd;
+            switch(*pos)
+            {
+                case 'p':// packet descriptions line
+                {
+                    ++ pos;
+                    int flowId = parseField(pos,lineEnd);
+                    int packetId = parseField(pos,lineEnd);
+                    long int arrivalTime = parseField(pos,lineEnd);
+                    int packetLength = parseField(pos,lineEnd);
+                    //! the output port is optional (port 0 by default)
+                    while (pos < lineEnd && (*pos == ' ' || *pos == '\t' || *pos == '\r')) ++ pos;
+                    int portId = pos < lineEnd ? parseField(pos,lineEnd) : 0;
+                    packets.push_back(new Packet(flowId,packetId,packetLength,arrivalTime,portId));
+                    break;
+                }
+                case 'c':// comments
+                    break;
+                default:// unknown
+                    throw new std::runtime_error("Unknown declaration.");
+            }
+            pos = lineEnd;
+        }
+    }
+    //! function to read and parse the lines starting in the byte range [begin,end) of the file
+    void readChunk(std::streamoff begin,std::streamoff end,std::vector<Packet *>& packets)
+    {
+        std::ifstream infile(mInput,std::ios::in | std::ios::binary);
+        //! include the byte before the range to know whether a line starts at begin
+        std::streamoff from = begin > mDataOffset ? begin - 1 : begin;
+        infile.seekg(from);
+        std::string buffer(end - from,'\0');
+        infile.read(&buffer[0],buffer.size());
+        buffer.resize(infile.gcount());
+        //! complete the last line, which may end beyond the range
+        char c;
+        if (!buffer.empty() && buffer.back() != '\n')
+            while (infile.get(c) && c != '\n')
+                buffer.push_back(c);
+        buffer.push_back('\n');
+
+        const char *pos = buffer.data();
+        const char *rangeEnd = buffer.data() + (end - from);
+        if (from < begin)
+        {//! skip the line started in the previous range
+            while (*pos != '\n') ++ pos;
+            ++ pos;
+        }
+        if (pos >= rangeEnd) return;
+        //! the last line starting in the range ends at the last newline of the buffer
+        parseChunk(pos,buffer.data() + buffer.size(),packets);
+    }
+    //! function to read the flow configuration
+    void readHeader()
+    {
+        std::string lines;
+        int flowNum = -1;
+        std::string flowWeightConf;
+        bool isEqualWeight;
+        double flowWeight;
+        char c;
+
+        //! try to read flow configuration
+        while (mInfile >> c)
+        {
+            switch(c)
+            {
+                case 'f':// flow description
+                    if(mInfile >> flowNum >> flowWeightConf)
+                    {
+                        std::getline(mInfile, lines);// pass through this line
+                        if(flowWeightConf=="eq") isEqualWeight = true;
+                        else if(flowWeightConf=="neq") isEqualWeight = false;
+                        else throw new std::runtime_error("Unknown flow flowWeight configuration.");
+                    }
+                    else
+                    {
+                        throw new std::runtime_error("Missing or wrong flow configuration.");
+                    }
+                    break;
+                case 'c':// comments
+                    std::getline(mInfile, lines);// skip this line
+                    break;
+                default:// unknown
+                    throw new std::runtime_error("Unknown declaration.");
+            }
+            if (flowNum > 0) break;
+        }
+        if (flowNum <= 0)
+            throw new std::runtime_error("Missing or wrong flow configuration.");
+
+        if (!isEqualWeight)
+        {// read flow weights
+            while (mInfile >> c)
+            {
+                switch(c)
+                {
+                    case 'w':// weights line
+                    {
+                        while (mFlowWeights.size() < flowNum && mInfile >> flowWeight)
+                            mFlowWeights.push_back(flowWeight);
+                        std::getline(mInfile,lines);
+                        if (mFlowWeights.size() < flowNum)
+                            throw new std::runtime_error("Missing or wrong flow flowWeight configuration");
+                        break;
+                    }
+                    case 'c':
+                        std::getline(mInfile,lines);
+                        break;
+                    default:
+                        throw new std::runtime_error("Unknown declaration.");
+                }
+
+                if (mFlowWeights.size() == flowNum)// jump out the while loop
+                    break;
+            }
+        }
+        else
+        {
+            for (int i = 0;i < flowNum;++ i)
+                mFlowWeights.push_back(1.0);
+        }
+    }
+public:
+    //! constructor, opens the file and reads the flow configuration
+    TraceReader(const std::string& input)
+    {
+        mInput = input;
+        mInfile.open(input);
+        if (!mInfile.is_open())
+            throw new std::runtime_error("Cannot open input file.");
+        readHeader();
+        mDataOffset = mInfile.tellg();
+    }
+    ~TraceReader()
+    {
+        mInfile.close();
+    }
+    //! get the weight of each flow
+    std::vector<double>& GetFlowWeights()
+    {
+        return mFlowWeights;
+    }
+    //! function to read the next packet, returns NULL at the end of the file
+    Packet* next()
+    {
+        std::string lines;
+        int flowId, packetId, packetLength, portId;
+        long int arrivalTime;
+        char c;
+
+        while (!mInfile.eof() && mInfile >> c)
+            switch(c)
+            {
+                case 'p':// packet descriptions line
+                {
+                    if (mInfile >> flowId >> packetId >> arrivalTime >> packetLength)
+                    {
+                        //! the output port is optional (port 0 by default)
+                        std::getline(mInfile,lines);
+                        std::istringstream rest(lines);
+                        if (!(rest >> portId)) portId = 0;
+                        return new Packet(flowId,packetId,packetLength,arrivalTime,portId);
+                    }
+                    else throw new std::runtime_error("Missing or wrong packet description.");
+                }
+                case 'c':// comments
+                    std::getline(mInfile,lines);
+                    break;
+                default:// unknown
+                    throw new std::runtime_error("Unknown declaration.");
+            }
+        return NULL;
+    }
+    //! function to read at most maxNum packets into batch, returns the number of packets read
+    size_t nextBatch(std::vector<Packet *>& batch,size_t maxNum)
+    {
+        batch.clear();
+        Packet *p;
+        while (batch.size() < maxNum && (p = next()) != NULL)
+            batch.push_back(p);
+        return batch.size();
+    }
+    //! function to read all the packets in parallel
+    /*! the packet lines are split into byte ranges aligned to line boundaries, which
+        are parsed by threadNum threads (0 means one thread per hardware thread). The 
+        packets are returned in file order, or, if mergeByArrival is true, every range
+        is stably sorted by arrival time and the ranges are k-way merged (so that the
+        result equals a stable sort of the file by arrival time). The ranges are of
+        at least minChunkSize bytes, unless there is only one.
+        This function does not change the position of next().
+    */
+    void readAllParallel(std::vector<Packet *>& packets,unsigned threadNum = 0,bool mergeByArrival = false,std::streamoff minChunkSize = 1 << 20)
+    {
+        if (threadNum == 0)
+            threadNum = std::max(1u,std::thread::hardware_concurrency());
+        std::ifstream infile(mInput,std::ios::in | std::ios::binary | std::ios::ate);
+        std::streamoff fileSize = infile.tellg();
+        infile.close();
+
+        //! a few ranges per thread so that a slow range does not hold back the others
+        minChunkSize = std::max<std::streamoff>(minChunkSize,1);
+        std::streamoff dataSize = std::max<std::streamoff>(fileSize - mDataOffset,0);
+        size_t chunkNum = std::max<std::streamoff>(1,std::min<std::streamoff>(threadNum * 4,dataSize / minChunkSize));
+        std::vector<std::vector<Packet *> > chunks(chunkNum);
+        std::vector<std::exception_ptr> errors(threadNum);
+        std::atomic<size_t> nextChunk(0);
+
+        auto worker = [&](unsigned t){
+            try {
+                size_t i;
+                while ((i = nextChunk ++) < chunkNum)
+                {
+                    std::streamoff begin = mDataOffset + dataSize * i / chunkNum;
+                    std::streamoff end = mDataOffset + dataSize * (i + 1) / chunkNum;
+                    readChunk(begin,end,chunks[i]);
+                    if (mergeByArrival)
+                        std::stable_sort(chunks[i].begin(),chunks[i].end(),PKT_Compare_AT_L());
+                }
+            }
+            catch (...) {
+                errors[t] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned t = 1;t < threadNum;++ t)
+            threads.push_back(std::thread(worker,t));
+        worker(0);
+        for (auto& t: threads)
+            t.join();
+        for (auto& e: errors)
+            if (e)
+            {
+                for (auto& chunk: chunks)
+                    for (auto pPKT: chunk)
+                        delete pPKT;
+                std::rethrow_exception(e);
+            }
+
+        size_t total = packets.size();
+        for (auto& chunk: chunks)
+            total += chunk.size();
+        packets.reserve(total);
+        if (!mergeByArrival)
+        {
+            for (auto& chunk: chunks)
+                packets.insert(packets.end(),chunk.begin(),chunk.end());
+            return;
+        }
+        //! k-way merge, ties are broken by range index to keep the file order
+        typedef std::pair<long int,size_t> Head;
+        std::priority_queue<Head,std::vector<Head>,std::greater<Head> > heads;
+        std::vector<size_t> cursors(chunkNum,0);
+        for (size_t i = 0;i < chunkNum;++ i)
+            if (!chunks[i].empty())
+                heads.push(Head(chunks[i][0]->mArrivalTime,i));
+        while (!heads.empty())
+        {
+            size_t i = heads.top().second;
+            heads.pop();
+            packets.push_back(chunks[i][cursors[i] ++]);
+            if (cursors[i] < chunks[i].size())
+                heads.push(Head(chunks[i][cursors[i]]->mArrivalTime,i));
+        }
+    }
+};
+
+#endif